@@ -14,14 +14,28 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
+#define _GNU_SOURCE
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #define MAX_CELLS 64000000
 
@@ -34,47 +48,295 @@ typedef enum { VAR,
                CONT,
                ISTREAM,
                STRING,
-               INTEGER } type_t;
+               INTEGER,
+               ENV,
+               OP,
+               BIGNUM,
+               BYTES,
+               BITSTRING,
+               PAIR,
+               TRUE,
+               FALSE,
+               COMB,
+               APP } type_t;
 
-typedef struct { int fun; int arg; } call_t;
-typedef struct { int block; int stack; } proc_t;
-typedef struct { int unwrap; int context; int cache; } wrap_t;
-typedef struct { int value; int target; } memoize_t;
-typedef struct { FILE *file; int used; } istream_t;
+typedef enum { ADD, SUB, MUL, EQ_STR, CONCAT, FIND, DROP, SEQ, PAR, CONS } op_t;
 
-typedef struct {
-  type_t type;
-  union {
-    int idx;
-    int body;
-    call_t call;
-    proc_t proc;
-    wrap_t wrap;
-    memoize_t memoize;
-    istream_t istream;
-    const char *string;
-    int term;
-    int k;
-    int integer;
+// Combinators of the graph reducer (see below).  An operation is a combinator
+// of its own following the others.
+typedef enum { COMB_S, COMB_K, COMB_I, COMB_B, COMB_C, COMB_V, COMB_OP } combinator_t;
+
+// A cell is packed into two 32-bit words.  The upper bits of the head hold
+// the type and the lower bits the first field, the tail holds the second
+// field.  Wraps, input streams, and operations do not fit and use a second
+// (extension) cell directly following the first one.
+typedef struct { uint32_t head; uint32_t tail; } cell_t;
+
+#define TYPE_BITS 5
+#define FIELD_BITS (32 - TYPE_BITS)
+#define FIELD_MASK ((1u << FIELD_BITS) - 1)
+// The fields of cells address the static region and one semispace.
+#define MAX_HEAP_SIZE ((int)(FIELD_MASK + 1))
+
+// The heap consists of two halves reserved with mmap.  Each half holds the
+// static region [0, static_end) followed by a semispace at heap_base, and
+// cells refers to the half in use.  Both semispaces use the same range of
+// indices, i.e. an index is a cell of the current half.  Cells are allocated
+// in [heap_start, heap_end) and copied over to the other half by the garbage
+// collector.  Only the first heap_size cells of each semispace are committed;
+// the heap grows on demand up to max_heap_size cells per semispace.  A heap
+// image restored at startup is mapped into the static region of both halves.
+// Static cells are never moved and never refer to other cells.
+__thread cell_t *heap_memory = NULL;
+__thread cell_t *cells = NULL;
+__thread int static_end = 0;
+__thread int heap_base = 0;
+__thread int heap_size = 1 << 16;
+__thread int max_heap_size = MAX_CELLS;
+__thread int huge_pages = 0;
+__thread int heap_start = 0;
+__thread int heap_end = 0;
+__thread int n_cells = 0;
+// Threads which share a heap (see spark) allocate from buffers claimed from
+// the top of the heap.  Otherwise the buffer is the rest of the heap.
+__thread int buffer_end = 0;
+__thread int sharing = 0;
+int heap_top = 0;
+// Mark of the thunks claimed by the current thread (see claim)
+__thread int thread_mark = 1;
+// Peak number of live cells (see peak_cells)
+__thread int high_water = 0;
+__thread int peak_collections = 0;
+__thread int n_collections = 0;
+// Evaluation steps and cells allocated before the last collection
+__thread long n_steps = 0;
+__thread long n_allocated = 0;
+__thread int n_live = 0;
+#ifndef NDEBUG
+// Debug tags are kept in a side table parallel to the cells.
+__thread const char **tags = NULL;
+#endif
+// New positions of the cells copied by the garbage collector plus one (see
+// gc_move)
+__thread int *forwarding = NULL;
+// Positions of the bytecode of terms (see below)
+__thread int *code_index = NULL;
+__thread int n_code = 0;
+// Graphs of closed lambdas (see below)
+__thread int *graph_index = NULL;
+__thread int n_graphs = 0;
+
+// Reserve for cells allocated by the host between two safe points.
+#define GC_MARGIN 4096
+
+__thread int gc_threshold = 0;
+// Reserve for the buffers of the threads sharing the heap
+__thread int reserved = 0;
+
+// Budgets of evaluation steps and of allocated cells (see eval_budget)
+__thread long step_limit = LONG_MAX;
+__thread long cell_limit = LONG_MAX;
+
+// The garbage collector runs before the reserve of the heap is used up.  The
+// threshold is lowered so that the evaluator also stops at the next safe
+// point when the budget of cells is exhausted.
+static void set_threshold(void)
+{
+  gc_threshold = heap_end - GC_MARGIN - reserved;
+  if (cell_limit != LONG_MAX) {
+    long left = cell_limit - (n_allocated + n_cells - heap_start - n_live);
+    if (left < gc_threshold - n_cells)
+      gc_threshold = n_cells + (left > 0 ? left : 0);
+  };
+}
+
+// The profiler counts evaluation steps and allocations per type of cell,
+// frames, hits and misses of thunks, and entries of blocks (bodies of
+// lambdas).  It is written to a file at exit and on SIGUSR1; the signal only
+// sets a flag which is polled at the next safe point of the evaluators.
+__thread int profile = 0;
+__thread const char *profile_name = NULL;
+volatile sig_atomic_t profile_requested = 0;
+__thread long profile_steps[APP + 1];
+__thread long profile_allocs[APP + 1];
+__thread long profile_alloc_cells[APP + 1];
+__thread long profile_hits = 0;
+__thread long profile_misses = 0;
+
+void profile_dump(void);
+
+static void count_allocation(int type, int n)
+{
+  if (profile) {
+    profile_allocs[type]++;
+    profile_alloc_cells[type] += n;
+  };
+}
+
+static size_t page_align(size_t size)
+{
+  size_t page = 2 << 20;
+  return (size + page - 1) / page * page;
+}
+
+// Number of cells of each half of the heap
+static size_t half_size(void) { return heap_base + (size_t)max_heap_size; }
+
+static void commit(int size)
+{
+  int half;
+  for (half = 0; half < 2; half++)
+    if (mprotect(heap_memory + half * half_size() + heap_base, page_align(size * sizeof(cell_t)),
+                 PROT_READ | PROT_WRITE)) {
+      perror("mprotect");
+      abort();
+    };
+}
+
+void setup_heap(void)
+{
+  // Round up so that the second semispace starts on a (huge) page boundary.
+  max_heap_size = page_align((size_t)max_heap_size * sizeof(cell_t)) / sizeof(cell_t);
+  if (heap_size < 4 * GC_MARGIN)
+    heap_size = 4 * GC_MARGIN;
+  if (max_heap_size < heap_size)
+    max_heap_size = heap_size;
+  heap_base = page_align((size_t)static_end * sizeof(cell_t)) / sizeof(cell_t);
+  // The fields of cells address the static region and one semispace, i.e.
+  // about 134M cells in total.
+  if (half_size() > (size_t)FIELD_MASK + 1) {
+    fprintf(stderr, "Heap of %d cells (with %d static cells) exceeds the %u addressable cells!\n",
+            max_heap_size, heap_base, FIELD_MASK + 1);
+    exit(1);
+  };
+  size_t reserve = 2 * half_size() * sizeof(cell_t);
+  heap_memory = mmap(NULL, reserve, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (heap_memory == MAP_FAILED) {
+    perror("mmap");
+    abort();
   };
+  cells = heap_memory;
+#ifdef MADV_HUGEPAGE
+  if (huge_pages)
+    madvise(cells, reserve, MADV_HUGEPAGE);
+#endif
+  // The side tables have an entry for each cell of both halves.
 #ifndef NDEBUG
-  const char *tag;
+  tags = mmap(NULL, 2 * half_size() * sizeof(const char *),
+              PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+              -1, 0);
+  if (tags == MAP_FAILED) {
+    perror("mmap");
+    abort();
+  };
 #endif
-} cell_t;
+  forwarding = mmap(NULL, 2 * half_size() * sizeof(int),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                    -1, 0);
+  if (forwarding == MAP_FAILED) {
+    perror("mmap");
+    abort();
+  };
+  code_index = mmap(NULL, 2 * half_size() * sizeof(int),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                    -1, 0);
+  if (code_index == MAP_FAILED) {
+    perror("mmap");
+    abort();
+  };
+  graph_index = mmap(NULL, 2 * half_size() * sizeof(int),
+                     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                     -1, 0);
+  if (graph_index == MAP_FAILED) {
+    perror("mmap");
+    abort();
+  };
+  commit(heap_size);
+  heap_start = heap_base;
+  heap_end = heap_start + heap_size;
+  n_cells = heap_start;
+  buffer_end = heap_end;
+  set_threshold();
+}
 
-cell_t cells[MAX_CELLS];
-int n_cells = 0;
+int grow_heap(void)
+{
+  int retval = heap_size < max_heap_size;
+  if (retval) {
+    heap_size = heap_size > max_heap_size / 2 ? max_heap_size : 2 * heap_size;
+    commit(heap_size);
+    heap_end = heap_start + heap_size;
+    if (!sharing)
+      buffer_end = heap_end;
+    set_threshold();
+  };
+  return retval;
+}
 
-int cell(int type)
+int cells_used(void) { return n_cells - heap_start; }
+
+long cells_allocated(void) { return n_allocated + cells_used() - n_live; }
+
+// The peak is the highest number of cells which survived a collection.  If
+// there was no collection since the peak was reset, all cells allocated
+// since then count as live.
+int peak_cells(void)
+{
+  if (n_collections == peak_collections && cells_used() > high_water)
+    return cells_used();
+  return high_water;
+}
+
+void reset_peak(void)
+{
+  high_water = cells_used();
+  peak_collections = n_collections;
+}
+
+static int size_of(int type)
 {
-  if (n_cells >= MAX_CELLS) {
+  return type == WRAP || type == ISTREAM || type == OP ? 2 : 1;
+}
+
+// A thread sharing the heap claims a new buffer when its buffer is used up.
+// The buffers are claimed in ascending order, i.e. a thread stops at its next
+// safe point once its buffer is beyond the threshold and waits for the
+// collection.
+#define BUFFER_SIZE 16384
+
+static int refill(int n)
+{
+  if (!sharing)
+    return grow_heap();
+  int size = n > BUFFER_SIZE ? n : BUFFER_SIZE;
+  int start = __atomic_fetch_add(&heap_top, size, __ATOMIC_RELAXED);
+  if (start > heap_end - size)
+    return 0;
+  n_cells = start;
+  buffer_end = start + size;
+  return 1;
+}
+
+static int allocate(int n)
+{
+  if (n_cells + n > buffer_end && !refill(n)) {
     fputs("Out of memory!\n", stderr);
     abort();
   };
-  int retval = n_cells++;
-  cells[retval].type = type;
+  int retval = n_cells;
+  n_cells += n;
+  return retval;
+}
+
+int cell(int type)
+{
+  int retval = allocate(size_of(type));
+  cells[retval].head = (uint32_t)type << FIELD_BITS;
+  cells[retval].tail = 0;
+  count_allocation(type, size_of(type));
 #ifndef NDEBUG
-  cells[retval].tag = NULL;
+  tags[retval] = NULL;
 #endif
   return retval;
 }
@@ -82,38 +344,61 @@ int cell(int type)
 #ifndef NDEBUG
 int tag(int cell, const char *value)
 {
-  cells[cell].tag = value;
+  tags[cell] = value;
   return cell;
 }
 #endif
 
-static void check_cell(int cell) { assert(cell >= 0 && cell < MAX_CELLS); }
+static void check_cell(int cell)
+{
+  assert((cell >= heap_start || (cell >= 0 && cell < static_end)) &&
+         (cell < n_cells || (sharing && cell < __atomic_load_n(&heap_top, __ATOMIC_RELAXED))));
+}
+
+static int field(int cell) { return cells[cell].head & FIELD_MASK; }
+static int field2(int cell) { return cells[cell].tail; }
+static void set_field(int cell, int value)
+{
+  assert(value >= 0 && value <= FIELD_MASK);
+  cells[cell].head = (cells[cell].head & ~FIELD_MASK) | value;
+}
+static void set_field2(int cell, int value) { cells[cell].tail = value; }
+static void *pointer(int cell) { void *retval; memcpy(&retval, &cells[cell + 1], sizeof(void *)); return retval; }
+static void set_pointer(int cell, const void *value) { memcpy(&cells[cell + 1], &value, sizeof(void *)); }
 
-int type(int cell) { check_cell(cell); return cells[cell].type; }
+int type(int cell) { check_cell(cell); return cells[cell].head >> FIELD_BITS; }
 
 int is_type(int cell, int t) { return type(cell) == t; }
 
-int idx(int cell) { assert(is_type(cell, VAR)); return cells[cell].idx; }
-int body(int cell) { assert(is_type(cell, LAMBDA)); return cells[cell].body; }
-int fun(int cell) { assert(is_type(cell, CALL)); return cells[cell].call.fun; }
-int arg(int cell) { assert(is_type(cell, CALL)); return cells[cell].call.arg; }
-int block(int cell) { assert(is_type(cell, PROC)); return cells[cell].proc.block; }
-int stack(int cell) { assert(is_type(cell, PROC)); return cells[cell].proc.stack; }
-int unwrap(int cell) { assert(is_type(cell, WRAP)); return cells[cell].wrap.unwrap; }
-int context(int cell) { assert(is_type(cell, WRAP)); return cells[cell].wrap.context; }
-int cache(int cell) { assert(is_type(cell, WRAP)); return cells[cell].wrap.cache; }
-int value(int cell) { assert(is_type(cell, MEMOIZE)); return cells[cell].memoize.value; }
-int target(int cell) { assert(is_type(cell, MEMOIZE)); return cells[cell].memoize.target; }
-int k(int cell) { assert(is_type(cell, CONT)); return cells[cell].k; }
-FILE *file(int cell) { assert(is_type(cell, ISTREAM)); return cells[cell].istream.file; }
-int used(int cell) { assert(is_type(cell, ISTREAM)); return cells[cell].istream.used; }
-const char *string(int cell) { assert(is_type(cell, STRING)); return cells[cell].string; }
-int intval(int cell) { assert(is_type(cell, INTEGER)); return cells[cell].integer; }
-
-const char *type_id(int cell)
+int idx(int cell) { assert(is_type(cell, VAR)); return field(cell); }
+int body(int cell) { assert(is_type(cell, LAMBDA)); return field(cell); }
+int fun(int cell) { assert(is_type(cell, CALL)); return field(cell); }
+int arg(int cell) { assert(is_type(cell, CALL)); return field2(cell) & FIELD_MASK; }
+int block(int cell) { assert(is_type(cell, PROC)); return field(cell); }
+int stack(int cell) { assert(is_type(cell, PROC)); return field2(cell); }
+int unwrap(int cell) { assert(is_type(cell, WRAP)); return field(cell); }
+int context(int cell) { assert(is_type(cell, WRAP)); return field2(cell); }
+int cache(int cell) { assert(is_type(cell, WRAP)); return __atomic_load_n(&cells[cell + 1].tail, __ATOMIC_ACQUIRE); }
+int value(int cell) { assert(is_type(cell, MEMOIZE)); return field(cell); }
+int target(int cell) { assert(is_type(cell, MEMOIZE)); return field2(cell); }
+int k(int cell) { assert(is_type(cell, CONT)); return field(cell); }
+FILE *file(int cell) { assert(is_type(cell, ISTREAM)); return pointer(cell); }
+int used(int cell) { assert(is_type(cell, ISTREAM)); return field(cell); }
+int storage(int cell) { assert(is_type(cell, STRING) || is_type(cell, BITSTRING)); return field(cell); }
+int offset(int cell) { assert(is_type(cell, STRING) || is_type(cell, BITSTRING)); return field2(cell); }
+int is_bit_stream(int cell) { assert(is_type(cell, ISTREAM)); return field2(cell); }
+int intval(int cell) { assert(is_type(cell, INTEGER)); return (int32_t)field2(cell); }
+int left(int cell) { assert(is_type(cell, OP)); return field(cell); }
+int right(int cell) { assert(is_type(cell, OP)); return field2(cell); }
+int opcode(int cell) { assert(is_type(cell, OP)); return field2(cell + 1); }
+int combinator(int cell) { assert(is_type(cell, COMB)); return field(cell); }
+int app_fun(int cell) { assert(is_type(cell, APP)); return field(cell); }
+int app_arg(int cell) { assert(is_type(cell, APP)); return field2(cell); }
+
+const char *type_name(int type)
 {
   const char *retval;
-  switch (type(cell)) {
+  switch (type) {
   case VAR:
     retval = "var";
     break;
@@ -144,34 +429,141 @@ const char *type_id(int cell)
   case INTEGER:
     retval = "integer";
     break;
+  case ENV:
+    retval = "env";
+    break;
+  case OP:
+    retval = "op";
+    break;
+  case BIGNUM:
+    retval = "bignum";
+    break;
+  case BYTES:
+    retval = "bytes";
+    break;
+  case BITSTRING:
+    retval = "bitstring";
+    break;
+  case PAIR:
+    retval = "pair";
+    break;
+  case TRUE:
+    retval = "true";
+    break;
+  case FALSE:
+    retval = "false";
+    break;
+  case COMB:
+    retval = "comb";
+    break;
+  case APP:
+    retval = "app";
+    break;
   default:
-    assert(0);
+    abort();
   };
   return retval;
 }
 
-int var(int idx)
+const char *type_id(int cell) { return type_name(type(cell)); }
+
+// Immutable terms (variables, lambdas, calls, and integers) are hash-consed
+// so that structurally equal terms share one cell.  The table does not keep
+// cells alive and is rebuilt after each garbage collection.
+__thread int hash_consing = 1;
+__thread int *cons_table = NULL;
+__thread int cons_table_size = 0;
+__thread int n_consed = 0;
+
+static uint32_t hash_cell(uint32_t head, uint32_t tail)
+{
+  uint32_t retval = head * 0x9e3779b1u ^ tail * 0x85ebca77u;
+  return retval ^ retval >> 16;
+}
+
+// The upper bits of the tail of a call hold annotations (see analyse) which
+// are not part of the term.
+static uint32_t term_tail(int cell)
+{
+  return cells[cell].head >> FIELD_BITS == CALL ? cells[cell].tail & FIELD_MASK : cells[cell].tail;
+}
+
+static void cons_insert(int cell)
+{
+  uint32_t mask = cons_table_size - 1;
+  uint32_t i = hash_cell(cells[cell].head, term_tail(cell)) & mask;
+  while (cons_table[i] >= 0)
+    i = (i + 1) & mask;
+  cons_table[i] = cell;
+  n_consed++;
+}
+
+// Reinsert the cells for which keep() returns a (new) index.
+static void rehash(int size, int (*keep)(int))
+{
+  int *old = cons_table;
+  int old_size = cons_table_size;
+  cons_table = malloc(size * sizeof(int));
+  if (!cons_table) {
+    fputs("Out of memory!\n", stderr);
+    abort();
+  };
+  cons_table_size = size;
+  n_consed = 0;
+  int i;
+  for (i = 0; i < size; i++)
+    cons_table[i] = -1;
+  for (i = 0; i < old_size; i++)
+    if (old[i] >= 0) {
+      int cell = keep(old[i]);
+      if (cell >= 0)
+        cons_insert(cell);
+    };
+  free(old);
+}
+
+static int keep_all(int cell) { return cell; }
+
+static int cons(int type, uint32_t field, uint32_t field2)
 {
-  int retval = cell(VAR);
-  cells[retval].idx = idx;
+  int retval;
+  uint32_t head = (uint32_t)type << FIELD_BITS | field;
+  if (hash_consing) {
+    if (2 * (n_consed + 1) > cons_table_size)
+      rehash(cons_table_size ? 2 * cons_table_size : 4096, keep_all);
+    uint32_t mask = cons_table_size - 1;
+    uint32_t i = hash_cell(head, field2) & mask;
+    while ((retval = cons_table[i]) >= 0) {
+      if (cells[retval].head == head && term_tail(retval) == field2)
+        return retval;
+      i = (i + 1) & mask;
+    };
+    retval = cell(type);
+    cons_table[i] = retval;
+    n_consed++;
+  } else
+    retval = cell(type);
+  cells[retval].head = head;
+  cells[retval].tail = field2;
   return retval;
 }
 
+int var(int idx)
+{
+  assert(idx >= 0 && idx <= FIELD_MASK);
+  return cons(VAR, idx, 0);
+}
+
 int lambda(int body)
 {
-  int retval = cell(LAMBDA);
-  cells[retval].body = body;
-  return retval;
+  return cons(LAMBDA, body, 0);
 }
 int lambda2(int body) { return lambda(lambda(body)); }
 int lambda3(int body) { return lambda(lambda(lambda(body))); }
 
 int call(int fun, int arg)
 {
-  int retval = cell(CALL);
-  cells[retval].call.fun = fun;
-  cells[retval].call.arg = arg;
-  return retval;
+  return cons(CALL, fun, arg);
 }
 int call2(int fun, int arg1, int arg2) { return call(call(fun, arg2), arg1); }
 int call3(int fun, int arg1, int arg2, int arg3) { return call(call(call(fun, arg3), arg2), arg1); }
@@ -183,564 +575,5272 @@ int op_if(int condition, int consequent, int alternative)
 int proc(int block, int stack)
 {
   int retval = cell(PROC);
-  cells[retval].proc.block = block;
-  cells[retval].proc.stack = stack;
+  set_field(retval, block);
+  set_field2(retval, stack);
   return retval;
 }
 
 int proc_self(int block)
 {
   int retval = cell(PROC);
-  cells[retval].proc.block = block;
-  cells[retval].proc.stack = block;
+  set_field(retval, block);
+  set_field2(retval, block);
   return retval;
 }
 
 int wrap(int unwrap, int context)
 {
   int retval = cell(WRAP);
-  cells[retval].wrap.unwrap = unwrap;
-  cells[retval].wrap.context = context;
-  cells[retval].wrap.cache = retval;
+  set_field(retval, unwrap);
+  set_field2(retval, context);
+  set_field2(retval + 1, retval);
+  set_field(retval + 1, 0);
   return retval;
 }
 
+// An updated thunk lets go of its term and environment so that the garbage
+// collector does not keep them alive as long as the value is reachable.
+// While the heap is shared, other threads may read the thunk and the
+// collector lets go instead (see gc_move).  A thunk claimed by another thread
+// is left to that thread (see claim).  The value is published before the
+// thunk is released.
 int store(int cell, int value)
 {
-  assert(is_type(cell, WRAP));
-  cells[cell].wrap.cache = value;
+  assert(is_type(cell, WRAP) && cell >= static_end);
+  uint32_t mark = __atomic_load_n(&cells[cell + 1].head, __ATOMIC_ACQUIRE) & FIELD_MASK;
+  if (sharing && mark && mark != (uint32_t)thread_mark)
+    return value;
+  if (!sharing) {
+    set_field(cell, value);
+    set_field2(cell, value);
+  };
+  __atomic_store_n(&cells[cell + 1].tail, value, __ATOMIC_RELEASE);
+  if (mark)
+    __atomic_store_n(&cells[cell + 1].head, cells[cell + 1].head & ~FIELD_MASK, __ATOMIC_RELEASE);
   return value;
 }
 
 int memoize(int value, int target)
 {
   int retval = cell(MEMOIZE);
-  cells[retval].memoize.value = value;
-  cells[retval].memoize.target = target;
+  set_field(retval, value);
+  set_field2(retval, target);
   return retval;
 }
 
 int cont(int k)
 {
   int retval = cell(CONT);
-  cells[retval].k = k;
+  set_field(retval, k);
   return retval;
 }
 
 int from_file(FILE *file)
 {
   int retval = cell(ISTREAM);
-  cells[retval].istream.file = file;
-  cells[retval].istream.used = retval;
+  set_pointer(retval, file);
+  set_field(retval, retval);
   return retval;
 }
 
-int from_str(const char *string)
+// An input stream which presents the bits of each byte (most significant
+// first) instead of the bytes.
+int from_bit_file(FILE *file)
 {
-  int retval = cell(STRING);
-  cells[retval].string = string;
+  int retval = from_file(file);
+  set_field2(retval, 1);
   return retval;
 }
 
+// Small integers (i.e. bytes) are interned even without hash-consing.
+#define N_SMALL_INTS 256
+
+__thread int small_ints[N_SMALL_INTS];
+__thread int n_small_ints = 0;
+
 int from_int(int integer)
 {
-  int retval = cell(INTEGER);
-  cells[retval].integer = integer;
+  int retval;
+  if (integer >= 0 && integer < N_SMALL_INTS) {
+    if (!n_small_ints) {
+      int i;
+      for (i = 0; i < N_SMALL_INTS; i++)
+        small_ints[i] = -1;
+      n_small_ints = N_SMALL_INTS;
+    };
+    retval = small_ints[integer];
+    if (retval < 0)
+      small_ints[integer] = retval = cons(INTEGER, 0, integer);
+  } else
+    retval = cons(INTEGER, 0, integer);
   return retval;
 }
 
-int f_ = -1;
-int t_ = -1;
-int f(void) { return f_; }
-int t(void) { return t_; }
+// Primitive binary operation on the values of two expressions.
+int op(op_t opcode, int left, int right)
+{
+  int retval = cell(OP);
+  set_field(retval, left);
+  set_field2(retval, right);
+  set_field2(retval + 1, opcode);
+  return retval;
+}
 
-int is_f_(int cell)
+int comb(combinator_t combinator)
 {
-  return cell == f();
+  return cons(COMB, combinator, 0);
 }
 
-int id_ = -1;
-int pair_ = -1;
-int id(void) { return id_; }
-int pair(int first, int rest) { return call2(pair_, first, rest); }
-int first_(int list) { return arg(list); }
-int rest_(int list) { return arg(fun(list)); }
-int at_(int list, int i)
+// Applications of the graph reducer are updated in place and therefore not
+// hash-consed.
+int app(int fun, int arg)
 {
-  if (is_f_(list)) {
-    fputs("Array out of range!\n", stderr);
-    abort();
+  int retval = cell(APP);
+  set_field(retval, fun);
+  set_field2(retval, arg);
+  return retval;
+}
+
+// Environments are vectors of 32-bit slots starting in the tail of the head
+// cell so that variables can be looked up by index.  An environment is
+// extended by copying its vector unless the vector holds ENV_CHUNK slots
+// already.  Then a new vector is started whose last slot links to the full
+// one, i.e. extending an environment copies at most ENV_CHUNK slots and a
+// variable is found after at most idx / (ENV_CHUNK - 1) links.  The link flag
+// in the head marks vectors which end with a link.
+#define ENV_CHUNK 8
+#define ENV_LINK (1u << (FIELD_BITS - 1))
+
+static int env_cells(int n) { return 1 + n / 2; }
+
+static uint32_t *slots(int env) { return &cells[env].tail; }
+
+static int allocate_slots(int type, int n)
+{
+  int retval = allocate(env_cells(n));
+  cells[retval].head = (uint32_t)type << FIELD_BITS;
+  count_allocation(type, env_cells(n));
+#ifndef NDEBUG
+  tags[retval] = NULL;
+#endif
+  return retval;
+}
+
+int env(int n)
+{
+  int retval = allocate_slots(ENV, n);
+  set_field(retval, n);
+  return retval;
+}
+
+// Number of slots of a vector (including the link)
+static int env_slots(int env) { return field(env) & ~ENV_LINK; }
+
+static int env_link(int env) { return field(env) & ENV_LINK ? (int)slots(env)[env_slots(env) - 1] : -1; }
+
+// Number of variables of an environment
+int env_size(int env)
+{
+  assert(is_type(env, ENV));
+  int retval = 0;
+  while (env_link(env) >= 0) {
+    retval += env_slots(env) - 1;
+    env = env_link(env);
   };
-  return i > 0 ? at_(rest_(list), i - 1) : first_(list);
+  return retval + env_slots(env);
 }
-int list1(int a) { return pair(a, f()); }
-int list2(int a, int b) { return pair(a, list1(b)); }
-int list3(int a, int b, int c) { return pair(a, list2(b, c)); }
-int list4(int a, int b, int c, int d) { return pair(a, list3(b, c, d)); }
-int list5(int a, int b, int c, int d, int e) { return pair(a, list4(b, c, d, e)); }
-int list6(int a, int b, int c, int d, int e, int f) { return pair(a, list5(b, c, d, e, f)); }
 
-int first(int list) { return call(list, t()); }
-int rest(int list) { return call(list, f()); }
-int empty(int list) { return call2(list, t(), lambda3(f())); }
-int at(int list, int i) { return i > 0 ? at(rest(list), i - 1) : first(list); }
-int replace(int list, int i, int value)
+// Look up a variable.  Returns -1 if the environment is too small.
+static int env_lookup(int env, int i)
 {
-  int retval;
-  if (i > 0)
-    retval = pair(first(list), replace(rest(list), i - 1, value));
-  else {
-    assert(i == 0);
-    retval = pair(value, rest(list));
+  int n;
+  while (i >= (n = env_slots(env) - (field(env) & ENV_LINK ? 1 : 0))) {
+    if (!(field(env) & ENV_LINK))
+      return -1;
+    i -= n;
+    env = slots(env)[n];
+  };
+  return slots(env)[i];
+}
+
+int env_at(int env, int i)
+{
+  assert(is_type(env, ENV));
+  int retval = env_lookup(env, i);
+  if (retval < 0) {
+    fputs("Array out of range!\n", stderr);
+    abort();
   };
   return retval;
 }
 
-// Y-combinator
-int recursive_ = -1;
-int recursive(int fun) { return call(recursive_, lambda(fun)); }
+// Natural numbers which do not fit into an integer cell are stored as bignums
+// with 32-bit limbs (least significant first) laid out like environments.
+static uint32_t *limbs(int bignum) { return &cells[bignum].tail; }
 
-int eq_bool_ = -1;
-int op_not(int a) { return op_if(a, f(), t()); }
-int op_and(int a, int b) { return op_if(a, b, f()); }
-int op_or(int a, int b) { return op_if(a, t(), b); }
-int op_xor(int a, int b) { return op_if(a, op_not(b), b); }
-int eq_bool(int a, int b) { return call2(eq_bool_, a, b); }
+int bignum(int n)
+{
+  int retval = allocate_slots(BIGNUM, n);
+  set_field(retval, n);
+  return retval;
+}
 
-#ifndef NDEBUG
-void show_(int cell, FILE *stream)
+int is_natural(int cell)
 {
-  if (cells[cell].tag)
-    fprintf(stream, "%s", cells[cell].tag);
-  else {
-    switch (type(cell)) {
-    case VAR:
-      fprintf(stream, "var(%d)", idx(cell));
-      break;
-    case LAMBDA:
-      fputs("lambda(", stream);
-      show_(body(cell), stream);
-      fputs(")", stream);
-      break;
-    case CALL:
-      fputs("call(", stream);
-      show_(fun(cell), stream);
-      fputs(", ", stream);
-      show_(arg(cell), stream);
-      fputs(")", stream);
-      break;
-    case PROC:
-      fputs("proc(", stream);
-      show_(block(cell), stream);
-      fputs(")", stream);
-      break;
-    case WRAP:
-      show_(unwrap(cell), stream);
-      break;
-    case MEMOIZE:
-      fputs("memoize(", stream);
-      show_(target(cell), stream);
-      fputs(")", stream);
-      break;
-    case CONT:
-      fputs("cont(", stream);
-      show_(k(cell), stream);
-      fputs(")", stream);
-      break;
-    default:
-      assert(0);
-    };
-  };
+  return is_type(cell, BIGNUM) || (is_type(cell, INTEGER) && intval(cell) >= 0);
 }
 
-void show(int cell, FILE *stream)
+int n_limbs(int cell)
 {
-  show_(cell, stream); fputc('\n', stream);
+  return is_type(cell, BIGNUM) ? field(cell) : intval(cell) != 0;
 }
-#endif
 
-int read_stream(int in)
+uint32_t limb(int cell, int i)
+{
+  uint32_t retval;
+  if (i >= n_limbs(cell))
+    retval = 0;
+  else if (is_type(cell, BIGNUM))
+    retval = limbs(cell)[i];
+  else
+    retval = intval(cell);
+  return retval;
+}
+
+// Create an integer or a bignum (if necessary) from an array of limbs.
+int from_limbs(const uint32_t *value, int n)
 {
   int retval;
-  if (used(in) != in)
-    retval = used(in);
+  while (n > 0 && value[n - 1] == 0)
+    n--;
+  if (n == 0)
+    retval = from_int(0);
+  else if (n == 1 && value[0] <= INT32_MAX)
+    retval = from_int(value[0]);
   else {
-    int c = fgetc(file(in));
-    if (c == EOF)
-      retval = f();
-    else
-      retval = pair(from_int(c), from_file(file(in)));
-    cells[in].istream.used = retval;
-  }
+    retval = bignum(n);
+    memcpy(limbs(retval), value, n * sizeof(uint32_t));
+  };
   return retval;
 }
 
-int read_string(int str)
+// Compare two natural numbers.
+int compare(int a, int b)
 {
-  char c = *string(str);
-  return c == '\0' ? f() : pair(from_int(c), from_str(string(str) + 1));
+  int i = n_limbs(a) > n_limbs(b) ? n_limbs(a) : n_limbs(b);
+  while (i-- > 0)
+    if (limb(a, i) != limb(b, i))
+      return limb(a, i) < limb(b, i) ? -1 : 1;
+  return 0;
 }
 
-int read_integer(int cell)
+// Scratch buffer for the limbs of results (reused across operations)
+__thread uint32_t *scratch = NULL;
+__thread int scratch_size = 0;
+
+static uint32_t *scratch_limbs(int n)
 {
-  int value = intval(cell);
-  assert(value >= 0);
-  return value == 0 ? f() : pair(value & 0x1 ? t() : f(), from_int(value >> 1));
+  if (n > scratch_size) {
+    scratch_size = n > 2 * scratch_size ? n : 2 * scratch_size;
+    scratch = realloc(scratch, scratch_size * sizeof(uint32_t));
+    if (!scratch) {
+      fputs("Out of memory!\n", stderr);
+      abort();
+    };
+  };
+  return scratch;
 }
 
-int eval_(int cell, int env, int cc)
+// Apply an arithmetic operation to two natural numbers.  Returns -1 if the
+// result is not a natural number.
+int arith(op_t opcode, int a, int b)
 {
   int retval;
-  int quit = 0;
-  int tmp;
-  while (!quit) {
-    switch (type(cell)) {
-    case VAR:
-      // this could be a call, too!
-      // use continuation?
-      // cell = eval_(fun(cell), env);
-      cell = at_(env, idx(cell));
+  if (is_type(a, INTEGER) && is_type(b, INTEGER)) {
+    int64_t x = intval(a);
+    int64_t y = intval(b);
+    int64_t z = opcode == ADD ? x + y : opcode == SUB ? x - y : x * y;
+    uint32_t value[2] = {(uint32_t)z, (uint32_t)(z >> 32)};
+    retval = z < 0 ? -1 : from_limbs(value, 2);
+  } else if (opcode == SUB && compare(a, b) < 0)
+    retval = -1;
+  else {
+    int n = opcode == MUL ? n_limbs(a) + n_limbs(b) : 1 + (n_limbs(a) > n_limbs(b) ? n_limbs(a) : n_limbs(b));
+    uint32_t *value = scratch_limbs(n);
+    memset(value, 0, n * sizeof(uint32_t));
+    int i, j;
+    int64_t carry = 0;
+    switch (opcode) {
+    case ADD:
+    case SUB:
+      for (i = 0; i < n; i++) {
+        carry += opcode == ADD ? (int64_t)limb(a, i) + limb(b, i) : (int64_t)limb(a, i) - limb(b, i);
+        value[i] = (uint32_t)carry;
+        carry >>= 32;
+      };
       break;
-    case LAMBDA:
-      cell = proc(body(cell), env);
+    default:
+      for (i = 0; i < n_limbs(a); i++) {
+        uint64_t product = 0;
+        for (j = 0; j < n_limbs(b); j++) {
+          product += (uint64_t)limb(a, i) * limb(b, j) + value[i + j];
+          value[i + j] = (uint32_t)product;
+          product >>= 32;
+        };
+        value[i + j] = (uint32_t)product;
+      };
+    };
+    retval = from_limbs(value, n);
+  };
+  return retval;
+}
+
+__thread int f_ = -1;
+__thread int t_ = -1;
+int f(void) { return f_; }
+int t(void) { return t_; }
+
+// Byte strings are stored in buffers laid out like environments (the bytes
+// start in the cell after the head).  The tail of the head cell holds the
+// list following the bytes, i.e. false or the input stream for the next block
+// of input.  A string refers to a buffer and an offset into it so that
+// unfolding it into a list does not copy any bytes.
+int bytes(int n)
+{
+  if ((uint32_t)n > FIELD_MASK) {
+    fputs("String too long!\n", stderr);
+    abort();
+  };
+  int retval = allocate_slots(BYTES, 2 * ((n + 7) / 8));
+  set_field(retval, n);
+  set_field2(retval, f());
+  return retval;
+}
+
+static char *data(int bytes) { return (char *)&cells[bytes + 1]; }
+
+// Shrink the chunk allocated last to n bytes and release the cells it does
+// not need anymore.
+static void shrink_bytes(int bytes, int n)
+{
+  assert(n >= 0 && n <= field(bytes) &&
+         n_cells == bytes + env_cells(2 * ((field(bytes) + 7) / 8)));
+  set_field(bytes, n);
+  n_cells = bytes + env_cells(2 * ((n + 7) / 8));
+}
+int next_chunk(int bytes) { return field2(bytes); }
+
+int string(int bytes, int offset)
+{
+  int retval = cell(STRING);
+  set_field(retval, bytes);
+  set_field2(retval, offset);
+  return retval;
+}
+
+const char *chars(int str) { return data(storage(str)) + offset(str); }
+int length(int str) { return field(storage(str)) - offset(str); }
+int is_complete(int str) { return next_chunk(storage(str)) == f(); }
+
+// A bit string is a view of a buffer with an offset counted in bits.
+int bit_string(int bytes, int offset)
+{
+  int retval = cell(BITSTRING);
+  set_field(retval, bytes);
+  set_field2(retval, offset);
+  return retval;
+}
+
+int n_bits(int str) { return 8 * field(storage(str)) - offset(str); }
+int bit_at(int str)
+{
+  return (unsigned char)data(storage(str))[offset(str) / 8] >> (7 - offset(str) % 8) & 1;
+}
+
+int from_bytes(const char *value, int n)
+{
+  int retval = bytes(n);
+  memcpy(data(retval), value, n);
+  return string(retval, 0);
+}
+
+int from_str(const char *value) { return from_bytes(value, strlen(value)); }
+
+// Concatenate two strings into a new buffer.
+int concat_bytes(int a, int b)
+{
+  int retval;
+  if (length(a) == 0)
+    retval = b;
+  else if (length(b) == 0)
+    retval = a;
+  else {
+    int n = length(a);
+    int buffer = bytes(n + length(b));
+    memcpy(data(buffer), chars(a), n);
+    memcpy(data(buffer) + n, chars(b), length(b));
+    retval = string(buffer, 0);
+  };
+  return retval;
+}
+
+// Return the rest of the string starting with the first occurrence of a
+// substring or -1 if there is none.
+int find_bytes(int haystack, int needle)
+{
+  int retval;
+  if (length(needle) == 0)
+    retval = haystack;
+  else {
+    const char *match = memmem(chars(haystack), length(haystack), chars(needle), length(needle));
+    retval = match ? string(storage(haystack), offset(haystack) + (match - chars(haystack))) : -1;
+  };
+  return retval;
+}
+
+// The evaluator keeps its continuation on a native stack of frames.  A frame
+// either holds the argument for the next application, a wrap to be updated
+// with the value of its expression, the second operand of a primitive
+// operation, or the value of the first operand.
+// An argument frame holds a call whose argument is evaluated before the call
+// (see analyse) together with the environment, the strict arguments further
+// down the spine, and the position of the bytecode which continues the call
+// (or -1).
+typedef enum { APPLY, UPDATE, OPERAND, OPERATE, ARGUMENT } frame_type_t;
+
+typedef struct { frame_type_t type; int value; op_t op; int env; int mask; int resume; } frame_t;
+
+__thread long profile_frames[ARGUMENT + 1];
+
+__thread frame_t *frames = NULL;
+__thread int frames_size = 0;
+__thread int n_frames = 0;
+
+void push_frame(frame_type_t type, int value)
+{
+  if (n_frames >= frames_size) {
+    frames_size = frames_size ? 2 * frames_size : 1024;
+    frames = realloc(frames, frames_size * sizeof(frame_t));
+    if (!frames) {
+      fputs("Out of memory!\n", stderr);
+      abort();
+    };
+  };
+  frames[n_frames].type = type;
+  frames[n_frames].value = value;
+  frames[n_frames].op = ADD;
+  frames[n_frames].env = -1;
+  frames[n_frames].mask = 0;
+  frames[n_frames].resume = -1;
+  n_frames++;
+  if (profile)
+    profile_frames[type]++;
+}
+
+// Materialize the frames above base as a continuation on the heap.  Frames
+// other than applications are stored as memoize(var(code), value) where the
+// code holds the type of frame and the operation.
+int capture(int base)
+{
+  int retval = cont(var(0));
+  int i;
+  for (i = base; i < n_frames; i++) {
+    int frame;
+    if (frames[i].type == APPLY)
+      frame = call(var(0), frames[i].value);
+    else if (frames[i].type == ARGUMENT)
+      frame = memoize(var(ARGUMENT - UPDATE), wrap(frames[i].value, frames[i].env));
+    else
+      frame = memoize(var(frames[i].type - UPDATE + 4 * frames[i].op),
+                      frames[i].value);
+    retval = cont(call(retval, frame));
+  };
+  return retval;
+}
+
+static int claim(int wrap);
+
+// Push the frames of a continuation onto the stack.
+void reinstate(int cc)
+{
+  int n = 0;
+  int c;
+  for (c = cc; !is_type(k(c), VAR); c = fun(k(c)))
+    n++;
+  int i;
+  for (i = 0; i < n; i++)
+    push_frame(APPLY, -1);
+  for (i = n_frames - 1, c = cc; !is_type(k(c), VAR); i--, c = fun(k(c))) {
+    int frame = arg(k(c));
+    if (is_type(frame, MEMOIZE)) {
+      frames[i].type = UPDATE + idx(value(frame)) % 4;
+      frames[i].op = idx(value(frame)) / 4;
+      frames[i].value = target(frame);
+      if (frames[i].type == ARGUMENT) {
+        frames[i].value = unwrap(target(frame));
+        frames[i].env = context(target(frame));
+      };
+      // Only the thread which claimed a thunk updates it (see store).
+      if (frames[i].type == UPDATE && sharing)
+        claim(frames[i].value);
+    } else {
+      assert(idx(fun(frame)) == 0);
+      frames[i].value = arg(frame);
+    };
+  };
+}
+
+// Handles held by the host (and the prelude) have to be registered as roots
+// so that the garbage collector can update them when moving cells.
+#define MAX_ROOTS 1024
+
+__thread int *roots[MAX_ROOTS];
+__thread int root_copies[MAX_ROOTS];
+__thread int n_roots = 0;
+
+void protect(int *handle)
+{
+  if (n_roots >= MAX_ROOTS) {
+    fputs("Too many roots!\n", stderr);
+    abort();
+  };
+  roots[n_roots++] = handle;
+}
+
+void unprotect(int n)
+{
+  assert(n_roots >= n);
+  n_roots -= n;
+}
+
+
+// Entries of the collector's stack refer to the first field (kind 0) or the
+// second field (kind 1) of a cell, to a whole word of an environment (kind 1
+// as well), or to the second field of a memoize which is copied without
+// selecting (kind 2, see gc_select).
+__thread int64_t *gc_stack = NULL;
+__thread int gc_stack_size = 0;
+__thread int n_gc_stack = 0;
+// While collecting, cells still refers to the old half of the heap and the
+// cells are copied to the other half (to_space).  Afterwards the survivors
+// are looked up in the forwarding table of the old half.
+__thread cell_t *to_space = NULL;
+__thread int *from_forwarding = NULL;
+
+static void gc_push(int64_t word, int kind)
+{
+  if (n_gc_stack >= gc_stack_size) {
+    gc_stack_size = gc_stack_size ? 2 * gc_stack_size : 1024;
+    gc_stack = realloc(gc_stack, gc_stack_size * sizeof(int64_t));
+    if (!gc_stack) {
+      fputs("Out of memory!\n", stderr);
+      abort();
+    };
+  };
+  gc_stack[n_gc_stack++] = 4 * word + kind;
+}
+
+static void gc_push_field(int cell, int second)
+{
+  gc_push(2 * (int64_t)cell + second, second);
+}
+
+// Push the references of a copied cell in reverse order so that the first
+// child is copied right after its parent (depth-first layout).
+static void gc_children(int cell)
+{
+  int i;
+  switch (to_space[cell].head >> FIELD_BITS) {
+  case LAMBDA:
+  case CONT:
+  case ISTREAM:
+  case STRING:
+  case BITSTRING:
+    gc_push_field(cell, 0);
+    break;
+  case CALL:
+    // The annotations in the upper bits of the tail are kept.
+    gc_push(2 * (int64_t)cell + 1, 3);
+    gc_push_field(cell, 0);
+    break;
+  case PROC:
+  case MEMOIZE:
+    // The thunk of a captured update stays a thunk (see gc_select).
+    gc_push(2 * (int64_t)cell + 1, 2);
+    gc_push_field(cell, 0);
+    break;
+  case OP:
+  case PAIR:
+  case APP:
+    gc_push_field(cell, 1);
+    gc_push_field(cell, 0);
+    break;
+  case WRAP:
+    gc_push_field(cell + 1, 1);
+    gc_push_field(cell, 1);
+    gc_push_field(cell, 0);
+    break;
+  case ENV:
+    for (i = (to_space[cell].head & FIELD_MASK & ~ENV_LINK) - 1; i >= 0; i--)
+      gc_push(2 * (int64_t)cell + 1 + i, 1);
+    break;
+  case BYTES:
+    gc_push_field(cell, 1);
+    break;
+  default:
+    break;
+  };
+}
+
+// Number of cells occupied by an object (without checking its index).
+static int cells_of(int cell)
+{
+  int type = cells[cell].head >> FIELD_BITS;
+  if (type == BYTES)
+    return env_cells(2 * ((field(cell) + 7) / 8));
+  if (type == ENV)
+    return env_cells(env_slots(cell));
+  return type == BIGNUM ? env_cells(field(cell)) : size_of(type);
+}
+
+// The old cells stay intact while they are copied, i.e. their fields refer to
+// old cells as well.  Every index seen by the collector refers to the old
+// half of the heap (or to a static cell), so each reference is updated
+// exactly once.
+static int gc_move(int cell)
+{
+  int retval;
+  if (cell < static_end)
+    retval = cell;
+  else if (forwarding[cell])
+    retval = forwarding[cell] - 1;
+  else {
+    int n = cells_of(cell);
+    retval = n_cells;
+    n_cells += n;
+    memcpy(to_space + retval, cells + cell, n * sizeof(cell_t));
+    // An evaluated thunk lets go of its term and environment (see store).
+    if (cells[cell].head >> FIELD_BITS == WRAP && field2(cell + 1) != cell) {
+      to_space[retval].head = (to_space[retval].head & ~FIELD_MASK) | field2(cell + 1);
+      to_space[retval].tail = field2(cell + 1);
+    };
+#ifndef NDEBUG
+    tags[retval + (to_space - cells)] = tags[cell];
+#endif
+    forwarding[cell] = retval + 1;
+    gc_children(retval);
+  };
+  return retval;
+}
+
+static int gc_type(int cell) { return cells[cell].head >> FIELD_BITS; }
+
+static int gc_lookup(int env, int i)
+{
+  int n;
+  if (gc_type(env) != ENV)
+    return -1;
+  while (i >= (n = env_slots(env) - (field(env) & ENV_LINK ? 1 : 0))) {
+    if (!(field(env) & ENV_LINK))
+      return -1;
+    i -= n;
+    env = slots(env)[n];
+  };
+  return slots(env)[i];
+}
+
+// A thunk which selects the first element or the rest of a pair bound to a
+// variable keeps the whole pair (and the environment) alive as long as it is
+// not evaluated.  If the pair was evaluated meanwhile, the collector replaces
+// the thunk with the element (see Wadler, "Fixing some space leaks with a
+// garbage collector").  This is what keeps state updated with replace in
+// bounded space.  Chains of such thunks are followed up to a limit.  Thunks
+// which are claimed (see claim) or being evaluated are left alone.  Returns
+// -1 if the thunk does not select from an evaluated pair.
+#define GC_MAX_SELECT 256
+
+static int gc_select(int wrap)
+{
+  int retval = -1;
+  int i;
+  for (i = 0; i < GC_MAX_SELECT; i++) {
+    if (gc_type(wrap) != WRAP || field(wrap + 1) || field2(wrap + 1) != wrap)
       break;
-    case CALL:
-      cc = cont(call(cc, call(var(0), wrap(arg(cell), env))));
-      cell = fun(cell);
+    int term = field(wrap);
+    if (gc_type(term) != CALL || gc_type(field(term)) != VAR)
       break;
-    case WRAP:
-      env = context(cell);
-      if (cache(cell) != cell)
-        cell = cache(cell);
-      else {
-        cc = cont(call(cc, memoize(var(0), cell)));
-        cell = unwrap(cell);
-      };
+    int select = gc_type(field2(term) & FIELD_MASK);
+    if (select != TRUE && select != FALSE)
       break;
-    case PROC:
-      if (is_type(k(cc), VAR)) {
-        assert(idx(k(cc)) == 0);
-        retval = cell;
-        quit = 1;
-      } else if (is_type(arg(k(cc)), MEMOIZE)) {
-        store(target(arg(k(cc))), cell);
-        cc = fun(k(cc));
-      } else {
-        assert(idx(fun(arg(k(cc)))) == 0);
-        env = pair(arg(arg(k(cc))), stack(cell));
-        cell = block(cell);
-        cc = fun(k(cc));
-      };
+    int value = gc_lookup(field2(wrap), field(field(term)));
+    if (value < 0)
       break;
-    case CONT:
-      if (is_type(k(cc), VAR)) {
-        assert(idx(k(cc)) == 0);
-        retval = cell;
-        quit = 1;
-      } else {
-        assert(idx(fun(arg(k(cc)))) == 0);
-        tmp = cell;
-        cell = arg(arg(k(cc)));
-        cc = tmp;
-      };
+    while (gc_type(value) == WRAP && field2(value + 1) != value)
+      value = field2(value + 1);
+    if (gc_type(value) != PAIR)
       break;
-    case ISTREAM:
-      if (is_type(k(cc), VAR)) {
-        assert(idx(k(cc)) == 0);
-        retval = cell;
-        quit = 1;
-      } else
-        cell = read_stream(cell);
+    retval = wrap = select == TRUE ? field(value) : field2(value);
+  };
+  return retval;
+}
+
+static int gc_comb(int cell, int combinator)
+{
+  return gc_type(cell) == COMB && field(cell) == combinator;
+}
+
+// The graph reducer has the same leak: first and rest become C I K p and
+// C I (K I) p, respectively, and a chain of them is only reduced when the
+// state is demanded.  If p is a pair V x y (possibly behind indirections),
+// the application is replaced with x or y.
+static int gc_select_graph(int app)
+{
+  int retval = -1;
+  int i;
+  for (i = 0; i < GC_MAX_SELECT; i++) {
+    if (gc_type(app) != APP)
       break;
-    case STRING:
-      if (is_type(k(cc), VAR)) {
-        assert(idx(k(cc)) == 0);
-        retval = cell;
-        quit = 1;
-      } else
-        cell = read_string(cell);
+    int fun = field(app);
+    if (gc_type(fun) != APP || gc_type(field(fun)) != APP ||
+        !gc_comb(field(field(fun)), COMB_C) || !gc_comb(field2(field(fun)), COMB_I))
       break;
-    case INTEGER:
-      if (is_type(k(cc), VAR)) {
-        assert(idx(k(cc)) == 0);
-        retval = cell;
-        quit = 1;
-      } else
-        cell = read_integer(cell);
+    int select = field2(fun);
+    int first = gc_comb(select, COMB_K);
+    if (!first && !(gc_type(select) == APP && gc_comb(field(select), COMB_K) &&
+                    gc_comb(field2(select), COMB_I)))
       break;
-    default:
-      fprintf(stderr, "Unexpected expression type '%s' in function 'eval_'!\n", type_id(cell));
-      abort();
-    };
+    int pair = field2(app);
+    while (gc_type(pair) == APP && gc_comb(field(pair), COMB_I))
+      pair = field2(pair);
+    if (gc_type(pair) != APP || gc_type(field(pair)) != APP || !gc_comb(field(field(pair)), COMB_V))
+      break;
+    retval = app = first ? field2(field(pair)) : field2(pair);
   };
   return retval;
 }
 
-int eval(int cell)
+static int gc_copy(int cell)
 {
-  return eval_(cell, f(), cont(var(0)));
+  int value;
+  if (cell >= static_end && !forwarding[cell] && cells[cell].head >> FIELD_BITS == APP &&
+      (value = gc_select_graph(cell)) >= 0) {
+    int retval = gc_move(value);
+    forwarding[cell] = retval + 1;
+    return retval;
+  };
+  if (cell >= static_end && !forwarding[cell] && cells[cell].head >> FIELD_BITS == WRAP &&
+      (value = gc_select(cell)) >= 0) {
+    int retval = gc_move(value);
+    forwarding[cell] = retval + 1;
+    return retval;
+  };
+  return gc_move(cell);
 }
 
-int is_f(int cell)
+static void gc_scan(void)
 {
-  return eval(op_if(cell, t(), f())) == f();
+  while (n_gc_stack > 0) {
+    int64_t slot = gc_stack[--n_gc_stack];
+    uint32_t *word = (uint32_t *)to_space + (slot >> 2);
+    if ((slot & 3) == 0 || (slot & 3) == 3)
+      *word = (*word & ~FIELD_MASK) | gc_copy(*word & FIELD_MASK);
+    else if ((slot & 3) == 1)
+      *word = gc_copy(*word);
+    else
+      *word = gc_move(*word);
+  };
 }
 
-int to_int(int number)
+static int gc_survivor(int cell)
 {
-  int eval_num = eval(number);
-  return !is_f(empty(eval_num)) ? 0 : (is_f(first(eval_num)) ? 0 : 0x1) | to_int(rest(eval_num)) << 1;
+  if (cell < static_end)
+    return cell;
+  return from_forwarding[cell] - 1;
 }
 
-int even_;
-int even(int list) { return call(even_, list); }
+// Sparks are thunks which may be evaluated in parallel.  They are evaluated
+// by a pool of worker threads which share the heap of the interpreter which
+// started them (one interpreter of a process at a time).  Each thread
+// allocates from its own buffer (see refill) and keeps a deque of the sparks
+// it created: a thread takes the newest spark of its own deque and steals the
+// oldest one of another thread if its own deque is empty.  Sparks are weak,
+// i.e. they are dropped when their thunk is collected or evaluated.
+//
+// A thread claims a thunk before evaluating it by writing its mark into the
+// extension cell (blackholing), so that no thunk is evaluated twice.  A
+// thread which enters a thunk claimed by another thread waits for the value
+// (see await).  Suspending an evaluation releases the thunks of its frames.
+//
+// Only the interpreter collects garbage.  It stops the world first: the
+// workers wait at their next safe point (or while they are idle), and a
+// worker whose buffer is beyond the threshold asks the interpreter for a
+// collection.  The roots of a worker are scanned after those of the
+// interpreter.  A worker whose spark is not reachable from the interpreter
+// (or from the workers it is needed by) is cancelled, i.e. it abandons its
+// spark at the next safe point.  Workers walk terms, do not hash-cons, and
+// abandon their spark instead of reading input.
+#define MAX_WORKERS 64
 
-int odd_;
-int odd(int list) { return call(odd_, list); }
+typedef struct { frame_t **frames; int *n_frames; int **roots; int *root_copies; int *n_roots;
+                 int *sparks; int head; int tail; int size; int spark; int cancel; } mutator_t;
 
-int shr_;
-int shr(int list) { return call(shr_, list); }
+// The state of the pool is guarded by the lock.  Idle workers wait for sparks
+// and stopped ones for the end of the collection.  The interpreter publishes
+// the layout of the heap and its roots after each collection.
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t resume;
+  pthread_cond_t parked;
+  cell_t *owner;
+  pthread_t threads[MAX_WORKERS];
+  mutator_t mutators[MAX_WORKERS + 1];
+  int n_workers;
+  int n_parked;
+  int n_idle;
+  int stop;
+  int collect;
+  int quit;
+  int epoch;
+  cell_t *cells;
+  const char **tags;
+  int static_end;
+  int heap_start;
+  int heap_end;
+  int reserved;
+  int small_ints[N_SMALL_INTS];
+  int *globals;
+} pool_t;
 
-int shl_;
-int shl(int list) { return call(shl_, list); }
+pool_t pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+               PTHREAD_COND_INITIALIZER};
+int pool_interrupt = 0;
+// Queued sparks and sparks evaluated by workers
+int n_sparks = 0;
+long n_sparked = 0;
 
-int add_;
-int add(int a, int b) { return call3(add_, a, b, f()); }
+__thread int workers = -1;
+__thread int is_worker = 0;
+__thread mutator_t *mutator = NULL;
 
-int sub_;
-int sub(int a, int b) { return call3(sub_, a, b, f()); }
+static void start_world(void);
+static void wait_for_collection(void);
 
-int mul_;
-int mul(int a, int b) { return call2(mul_, a, b); }
+// The threads sharing the heap check for a stopped world at safe points.
+static void interrupt(int value) { __atomic_store_n(&pool_interrupt, value, __ATOMIC_RELAXED); }
+static int interrupted(void) { return sharing && __atomic_load_n(&pool_interrupt, __ATOMIC_RELAXED); }
 
-#define BUFSIZE 1024
-char buffer[BUFSIZE];
+// Stop the workers before a collection.
+static void stop_world(void)
+{
+  pthread_mutex_lock(&pool.lock);
+  pool.stop = 1;
+  interrupt(1);
+  while (pool.n_parked < pool.n_workers)
+    pthread_cond_wait(&pool.parked, &pool.lock);
+  pthread_mutex_unlock(&pool.lock);
+}
 
-const char *to_buffer(int list, char *buffer, int bufsize)
+// Copy the cells referred to by the frames and roots of a thread.
+static void gc_roots(frame_t *stack, int depth, int **handles, int *copies, int n)
 {
-  if (bufsize <= 1) {
-    fputs("Buffer too small!\n", stderr);
+  int i;
+  // Thunks being evaluated stay thunks (see gc_select).
+  for (i = 0; i < depth; i++)
+    if (stack[i].type == UPDATE)
+      stack[i].value = gc_move(stack[i].value);
+  // A variable may be protected more than once, so the roots are updated
+  // after all of them were copied.
+  for (i = 0; i < n; i++)
+    if (*handles[i] >= 0) {
+      copies[i] = gc_copy(*handles[i]);
+      gc_scan();
+    };
+  for (i = 0; i < n; i++)
+    if (*handles[i] >= 0)
+      *handles[i] = copies[i];
+  for (i = depth - 1; i >= 0; i--) {
+    if (stack[i].type != UPDATE) {
+      stack[i].value = gc_copy(stack[i].value);
+      gc_scan();
+    };
+    if (stack[i].type == ARGUMENT) {
+      stack[i].env = gc_copy(stack[i].env);
+      gc_scan();
+    };
+  };
+}
+
+static void gc_mutator(mutator_t *m)
+{
+  gc_roots(*m->frames, *m->n_frames, m->roots, m->root_copies, *m->n_roots);
+}
+
+// Scan the roots of the workers whose sparks were reached, repeatedly, and
+// cancel the others (whose cells survive this collection nevertheless).
+static void gc_workers(void)
+{
+  int scanned[MAX_WORKERS + 1] = {0};
+  int more = 1;
+  int i;
+  while (more) {
+    more = 0;
+    for (i = 1; i <= pool.n_workers; i++) {
+      mutator_t *m = &pool.mutators[i];
+      if (!scanned[i] && m->spark >= 0 && (m->spark < static_end || forwarding[m->spark])) {
+        gc_mutator(m);
+        scanned[i] = more = 1;
+      };
+    };
+  };
+  for (i = 1; i <= pool.n_workers; i++)
+    if (!scanned[i] && pool.mutators[i].spark >= 0) {
+      pool.mutators[i].cancel = 1;
+      gc_mutator(&pool.mutators[i]);
+    };
+}
+
+// Drop the sparks whose thunks were collected, evaluated, or claimed.
+static void sweep_sparks(void)
+{
+  int i;
+  for (i = 0; i <= pool.n_workers; i++) {
+    mutator_t *m = &pool.mutators[i];
+    int n = 0;
+    int j;
+    for (j = m->head; j < m->tail; j++) {
+      int wrap = gc_survivor(m->sparks[j]);
+      if (wrap >= 0 && cache(wrap) == wrap && !field(wrap + 1))
+        m->sparks[n++] = wrap;
+    };
+    n_sparks -= m->tail - m->head - n;
+    m->head = 0;
+    m->tail = n;
+    if (m->spark >= 0)
+      m->spark = gc_survivor(m->spark);
+  };
+}
+
+// Entries of blocks are counted in a hash table keyed by the block.  The
+// counts of blocks which were collected are only kept as a total.
+typedef struct { int block; int owner; long count; } profile_entry_t;
+
+__thread profile_entry_t *profile_entries = NULL;
+__thread int profile_size = 0;
+__thread int n_profile_entries = 0;
+__thread long profile_collected = 0;
+
+static void profile_insert(int block, long count)
+{
+  uint32_t mask = profile_size - 1;
+  uint32_t i = hash_cell(block, 0) & mask;
+  while (profile_entries[i].block >= 0 && profile_entries[i].block != block)
+    i = (i + 1) & mask;
+  if (profile_entries[i].block < 0) {
+    profile_entries[i].block = block;
+    n_profile_entries++;
+  };
+  profile_entries[i].count += count;
+}
+
+static void profile_rehash(int size, int (*survivor)(int))
+{
+  profile_entry_t *old = profile_entries;
+  int old_size = profile_size;
+  profile_entries = malloc(size * sizeof(profile_entry_t));
+  if (!profile_entries) {
+    fputs("Out of memory!\n", stderr);
     abort();
   };
-  int eval_list = eval(list);
-  if (!is_f(empty(eval_list)))
-    *buffer = '\0';
-  else {
-    *buffer = to_int(first(eval_list));
-    to_buffer(rest(list), buffer + 1, bufsize - 1);
+  int i;
+  for (i = 0; i < size; i++) {
+    profile_entries[i].block = -1;
+    profile_entries[i].owner = -1;
+    profile_entries[i].count = 0;
   };
-  return buffer;
+  profile_size = size;
+  n_profile_entries = 0;
+  for (i = 0; i < old_size; i++)
+    if (old[i].block >= 0) {
+      int block = survivor(old[i].block);
+      if (block >= 0)
+        profile_insert(block, old[i].count);
+      else
+        profile_collected += old[i].count;
+    };
+  free(old);
 }
 
-const char *to_str(int list) { return to_buffer(list, buffer, BUFSIZE); }
+static void profile_enter(int block)
+{
+  if (2 * (n_profile_entries + 1) > profile_size)
+    profile_rehash(profile_size ? 2 * profile_size : 4096, keep_all);
+  profile_insert(block, 1);
+}
 
-int eq_list_ = -1;
-int eq_list(int eq_elem) { return call(eq_list_, eq_elem); }
-int eq_num_ = -1;
-int eq_num(int a, int b) { return call2(eq_num_, a, b); }
-int eq_str_ = -1;
-int eq_str(int a, int b) { return call2(eq_str_, a, b); }
+static void relocate_code(ptrdiff_t other, int used);
 
-int map_ = -1;
-int map(int list, int fun) { return call2(map_, fun, list); }
+void gc(void)
+{
+  if (is_worker) {
+    wait_for_collection();
+    return;
+  };
+  if (sharing) {
+    stop_world();
+    n_cells = heap_top < heap_end ? heap_top : heap_end;
+  };
+  int used = cells_used();
+  n_allocated += used - n_live;
+  ptrdiff_t other = cells == heap_memory ? (ptrdiff_t)half_size() : -(ptrdiff_t)half_size();
+  to_space = cells + other;
+  n_cells = heap_start;
+  int i;
+  gc_roots(frames, n_frames, roots, root_copies, n_roots);
+  if (sharing)
+    gc_workers();
+  for (i = 0; i < n_small_ints; i++)
+    if (small_ints[i] >= 0) {
+      small_ints[i] = gc_copy(small_ints[i]);
+      gc_scan();
+    };
+  gc_scan();
+  cell_t *from_space = cells;
+  cells = to_space;
+  from_forwarding = forwarding;
+  forwarding += other;
+#ifndef NDEBUG
+  tags += other;
+#endif
+  if (cons_table)
+    rehash(cons_table_size, gc_survivor);
+  if (profile_entries)
+    profile_rehash(profile_size, gc_survivor);
+  if (sharing)
+    sweep_sparks();
+  if (n_code)
+    relocate_code(other, used);
+  // Give the pages of the old semispace back to the operating system.
+  madvise(from_space + heap_start, page_align(used * sizeof(cell_t)), MADV_DONTNEED);
+  madvise(from_forwarding + heap_start, used * sizeof(int), MADV_DONTNEED);
+#ifndef NDEBUG
+  madvise(tags - other + heap_start, page_align(used * sizeof(const char *)), MADV_DONTNEED);
+#endif
+  code_index += other;
+  if (n_graphs) {
+    memset(graph_index, 0, static_end * sizeof(int));
+    madvise(graph_index + heap_start, used * sizeof(int), MADV_DONTNEED);
+    n_graphs = 0;
+  };
+  graph_index += other;
+  n_collections++;
+  n_live = cells_used();
+  if (n_live > high_water)
+    high_water = n_live;
+  while (2 * (cells_used() + reserved) > heap_size && grow_heap());
+  if (n_cells >= heap_end - GC_MARGIN - reserved) {
+    fputs("Out of memory!\n", stderr);
+    abort();
+  };
+  set_threshold();
+  if (sharing)
+    start_world();
+}
+
+int is_f_(int cell)
+{
+  return cell == f();
+}
+
+__thread int id_ = -1;
+__thread int pair_ = -1;
+int id(void) { return id_; }
+int pair(int first, int rest) { return call2(pair_, first, rest); }
+
+// Pairs and booleans are cells of their own which the evaluators apply like
+// their Church encodings (see walk).  A pair holds the values (or wraps) of
+// its elements.
+int is_pair(int cell) { return is_type(cell, PAIR); }
+
+int pair_value(int first, int rest)
+{
+  int retval = cell(PAIR);
+  set_field(retval, first);
+  set_field2(retval, rest);
+  return retval;
+}
+
+int first_(int list) { return is_pair(list) ? field(list) : arg(list); }
+int rest_(int list) { return is_pair(list) ? field2(list) : arg(fun(list)); }
+int at_(int list, int i)
+{
+  if (is_type(list, ENV))
+    return env_at(list, i);
+  if (is_f_(list)) {
+    fputs("Array out of range!\n", stderr);
+    abort();
+  };
+  return i > 0 ? at_(rest_(list), i - 1) : first_(list);
+}
+
+// Create a new environment with the value prepended. Environments built as
+// lists of pairs by the host are converted; any other stack (e.g. of a
+// closure created with proc_self) counts as empty.
+int extend(int stack, int value)
+{
+  int retval;
+  if (is_type(stack, ENV)) {
+    int n = env_slots(stack);
+    if (n < ENV_CHUNK) {
+      retval = env(n + 1);
+      set_field(retval, field(stack) + 1);
+      memcpy(slots(retval) + 1, slots(stack), n * sizeof(uint32_t));
+    } else {
+      retval = env(2);
+      set_field(retval, 2 | ENV_LINK);
+      slots(retval)[1] = stack;
+    };
+  } else {
+    int n = 0;
+    int list;
+    for (list = stack; is_type(list, CALL); list = rest_(list))
+      n++;
+    retval = env(n + 1);
+    int i;
+    for (i = 0, list = stack; i < n; i++, list = rest_(list))
+      slots(retval)[i + 1] = first_(list);
+  };
+  slots(retval)[0] = value;
+  return retval;
+}
+int list1(int a) { return pair(a, f()); }
+int list2(int a, int b) { return pair(a, list1(b)); }
+int list3(int a, int b, int c) { return pair(a, list2(b, c)); }
+int list4(int a, int b, int c, int d) { return pair(a, list3(b, c, d)); }
+int list5(int a, int b, int c, int d, int e) { return pair(a, list4(b, c, d, e)); }
+int list6(int a, int b, int c, int d, int e, int f) { return pair(a, list5(b, c, d, e, f)); }
+
+int first(int list) { return call(list, t()); }
+int rest(int list) { return call(list, f()); }
+int empty(int list) { return call2(list, t(), lambda3(f())); }
+int at(int list, int i) { return i > 0 ? at(rest(list), i - 1) : first(list); }
+int replace(int list, int i, int value)
+{
+  int retval;
+  if (i > 0)
+    retval = pair(first(list), replace(rest(list), i - 1, value));
+  else {
+    assert(i == 0);
+    retval = pair(value, rest(list));
+  };
+  return retval;
+}
+
+// Y-combinator
+__thread int recursive_ = -1;
+int recursive(int fun) { return call(recursive_, lambda(fun)); }
+
+__thread int eq_bool_ = -1;
+int op_not(int a) { return op_if(a, f(), t()); }
+int op_and(int a, int b) { return op_if(a, b, f()); }
+int op_or(int a, int b) { return op_if(a, t(), b); }
+int op_xor(int a, int b) { return op_if(a, op_not(b), b); }
+int eq_bool(int a, int b) { return call2(eq_bool_, a, b); }
+
+#ifndef NDEBUG
+void show_(int cell, FILE *stream)
+{
+  if (tags[cell])
+    fprintf(stream, "%s", tags[cell]);
+  else {
+    switch (type(cell)) {
+    case VAR:
+      fprintf(stream, "var(%d)", idx(cell));
+      break;
+    case LAMBDA:
+      fputs("lambda(", stream);
+      show_(body(cell), stream);
+      fputs(")", stream);
+      break;
+    case CALL:
+      fputs("call(", stream);
+      show_(fun(cell), stream);
+      fputs(", ", stream);
+      show_(arg(cell), stream);
+      fputs(")", stream);
+      break;
+    case PROC:
+      fputs("proc(", stream);
+      show_(block(cell), stream);
+      fputs(")", stream);
+      break;
+    case WRAP:
+      show_(unwrap(cell), stream);
+      break;
+    case MEMOIZE:
+      fputs("memoize(", stream);
+      show_(target(cell), stream);
+      fputs(")", stream);
+      break;
+    case CONT:
+      fputs("cont(", stream);
+      show_(k(cell), stream);
+      fputs(")", stream);
+      break;
+    case OP:
+      fprintf(stream, "op(%d, ", opcode(cell));
+      show_(left(cell), stream);
+      fputs(", ", stream);
+      show_(right(cell), stream);
+      fputs(")", stream);
+      break;
+    case INTEGER:
+      fprintf(stream, "%d", intval(cell));
+      break;
+    case STRING:
+      fputc('"', stream);
+      fwrite(chars(cell), 1, length(cell), stream);
+      fputc('"', stream);
+      break;
+    case BITSTRING:
+      fprintf(stream, "bits(%d)", n_bits(cell));
+      break;
+    case PAIR:
+      fputs("pair(", stream);
+      show_(first_(cell), stream);
+      fputs(", ", stream);
+      show_(rest_(cell), stream);
+      fputs(")", stream);
+      break;
+    case TRUE:
+      fputs("true", stream);
+      break;
+    case FALSE:
+      fputs("false", stream);
+      break;
+    case COMB:
+      if (combinator(cell) < COMB_OP)
+        fputc("SKIBCV"[combinator(cell)], stream);
+      else
+        fprintf(stream, "op%d", combinator(cell) - COMB_OP);
+      break;
+    case APP:
+      fputs("app(", stream);
+      show_(app_fun(cell), stream);
+      fputs(", ", stream);
+      show_(app_arg(cell), stream);
+      fputs(")", stream);
+      break;
+    default:
+      assert(0);
+    };
+  };
+}
+
+void show(int cell, FILE *stream)
+{
+  show_(cell, stream); fputc('\n', stream);
+}
+#endif
+
+// Output is collected in a buffer and written with few system calls.  The
+// buffer is flushed at newlines if the output is line buffered (e.g. a
+// terminal) and before blocking on input.
+#define OUTPUT_BUFSIZE 65536
+
+__thread char output_buffer[OUTPUT_BUFSIZE];
+__thread int n_output = 0;
+__thread int output_fd = -1;
+__thread int line_buffered = 0;
+__thread int bit_io = 0;
+
+static void write_all(const char *data, size_t n)
+{
+  while (n > 0) {
+    ssize_t written = write(output_fd, data, n);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("write");
+      exit(1);
+    };
+    data += written;
+    n -= written;
+  };
+}
+
+void flush_output(void)
+{
+  if (n_output > 0) {
+    write_all(output_buffer, n_output);
+    n_output = 0;
+  };
+}
+
+static void put_char(char c)
+{
+  if (n_output == OUTPUT_BUFSIZE)
+    flush_output();
+  output_buffer[n_output++] = c;
+  if (c == '\n' && line_buffered)
+    flush_output();
+}
+
+static void put_bytes(const char *data, size_t n)
+{
+  if (n_output + n > OUTPUT_BUFSIZE) {
+    flush_output();
+    if (n > OUTPUT_BUFSIZE / 2) {
+      write_all(data, n);
+      return;
+    };
+  };
+  memcpy(output_buffer + n_output, data, n);
+  n_output += n;
+  if (line_buffered && memchr(data, '\n', n))
+    flush_output();
+}
+
+// Input is read in blocks.  Each block becomes a string whose buffer is
+// followed by a new input stream for the rest of the file.  The result is
+// stored in the stream so that it is read only once.  A block is read
+// directly into a chunk of the largest size which is shrunk afterwards.
+#define INPUT_BUFSIZE 16384
+
+int read_stream(int in)
+{
+  int retval;
+  if (used(in) != in)
+    retval = used(in);
+  else {
+    // A worker abandons its spark at the next safe point instead (see spark).
+    if (is_worker) {
+      step_limit = 0;
+      return in;
+    };
+    flush_output();
+    int chunk = bytes(INPUT_BUFSIZE);
+    ssize_t n;
+    do
+      n = read(fileno(file(in)), data(chunk), INPUT_BUFSIZE);
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+      perror("read");
+    shrink_bytes(chunk, n > 0 ? n : 0);
+    if (n <= 0)
+      retval = f();
+    else {
+      if (is_bit_stream(in)) {
+        set_field2(chunk, from_bit_file(file(in)));
+        retval = bit_string(chunk, 0);
+      } else {
+        set_field2(chunk, from_file(file(in)));
+        retval = string(chunk, 0);
+      };
+    };
+    set_field(in, retval);
+  }
+  return retval;
+}
+
+int read_string(int str)
+{
+  int retval;
+  if (length(str) == 0)
+    retval = next_chunk(storage(str));
+  else {
+    unsigned char c = *chars(str);
+    retval = pair_value(from_int(c), string(storage(str), offset(str) + 1));
+  };
+  return retval;
+}
+
+// Bits are read as in binary lambda calculus where true stands for 0 and
+// false for 1.  The next 64 bits (or the rest of the block) are loaded into a
+// host word and unfolded at once so that each bit costs a single pair.
+int read_bits(int str)
+{
+  int retval;
+  int n = n_bits(str);
+  if (n == 0)
+    retval = next_chunk(storage(str));
+  else {
+    if (n > 64)
+      n = 64;
+    const unsigned char *p = (const unsigned char *)data(storage(str)) + offset(str) / 8;
+    int shift = offset(str) % 8;
+    int m = (shift + n + 7) / 8;
+    uint64_t word = 0;
+    int i;
+    for (i = 0; i < m && i < 8; i++)
+      word = word << 8 | p[i];
+    word <<= 8 * (8 - i);
+    if (shift)
+      word = word << shift | (m > 8 ? p[8] >> (8 - shift) : 0);
+    retval = bit_string(storage(str), offset(str) + n);
+    for (i = n - 1; i >= 0; i--)
+      retval = pair_value(word >> (63 - i) & 1 ? f() : t(), retval);
+  };
+  return retval;
+}
+
+int read_integer(int cell)
+{
+  int retval;
+  if (is_type(cell, BIGNUM)) {
+    int n = n_limbs(cell);
+    uint32_t *value = scratch_limbs(n);
+    int i;
+    for (i = 0; i < n; i++)
+      value[i] = limb(cell, i) >> 1 | (i + 1 < n ? limb(cell, i + 1) << 31 : 0);
+    retval = pair_value(limb(cell, 0) & 0x1 ? t() : f(), from_limbs(value, n));
+  } else {
+    int value = intval(cell);
+    assert(value >= 0);
+    retval = value == 0 ? f() : pair_value(value & 0x1 ? t() : f(), from_int(value >> 1));
+  };
+  return retval;
+}
+
+__thread int even_;
+int even(int list) { return call(even_, list); }
+
+__thread int odd_;
+int odd(int list) { return call(odd_, list); }
+
+__thread int shr_;
+int shr(int list) { return call(shr_, list); }
+
+__thread int shl_;
+int shl(int list) { return call(shl_, list); }
+
+// Arithmetic on lists of bits
+__thread int add_;
+int add_list(int a, int b) { return call3(add_, a, b, f()); }
+
+__thread int sub_;
+int sub_list(int a, int b) { return call3(sub_, a, b, f()); }
+
+__thread int mul_;
+int mul_list(int a, int b) { return call2(mul_, a, b); }
+
+// Arithmetic which stays native as long as both operands are numbers
+int add(int a, int b) { return op(ADD, a, b); }
+int sub(int a, int b) { return op(SUB, a, b); }
+int mul(int a, int b) { return op(MUL, a, b); }
+
+// Evaluate the first operand before returning the second one
+int seq(int a, int b) { return op(SEQ, a, b); }
+
+// Spark the first operand (a variable) for parallel evaluation and return the
+// second one
+int par(int a, int b) { return op(PAR, a, b); }
+
+// String operations which stay native as long as both operands are strings
+__thread int eq_str_list_ = -1;
+__thread int concat_list_ = -1;
+__thread int prefix_ = -1;
+__thread int find_list_ = -1;
+__thread int drop_list_ = -1;
+
+// Skip bytes (or bits) of a string or an input stream without unfolding them
+// into a list.  At most one block of input is read so that the evaluator can
+// collect garbage before skipping the remaining bytes.  Returns -1 for other
+// lists.
+int drop_bytes(int list, int n)
+{
+  int retval;
+  if (n == 0)
+    retval = list;
+  else {
+    if (is_type(list, ISTREAM))
+      list = read_stream(list);
+    if (list == f())
+      retval = list;
+    else if (!is_type(list, STRING) && !is_type(list, BITSTRING))
+      retval = -1;
+    else {
+      int size = is_type(list, STRING) ? length(list) : n_bits(list);
+      if (n >= size)
+        retval = n == size || is_complete(list) ? next_chunk(storage(list)) :
+                 op(DROP, next_chunk(storage(list)), from_int(n - size));
+      else if (is_type(list, STRING))
+        retval = string(storage(list), offset(list) + n);
+      else
+        retval = bit_string(storage(list), offset(list) + n);
+    };
+  };
+  return retval;
+}
+
+// Prepend the bytes of a string to a list which may not be evaluated yet
+// (i.e. a thunk).  The bytes are copied into a buffer which is followed by the
+// rest of the string and then by the list.  Returns -1 if the first operand
+// is not a string.
+int append_bytes(int a, int b)
+{
+  int retval;
+  if (is_type(a, ISTREAM))
+    a = read_stream(a);
+  while (is_type(b, WRAP) && cache(b) != b)
+    b = cache(b);
+  if (a == f())
+    retval = b;
+  else if (!is_type(a, STRING))
+    retval = -1;
+  else if (is_complete(a) && is_type(b, STRING) && is_complete(b))
+    retval = concat_bytes(a, b);
+  else {
+    int rest = is_complete(a) ? b : op(CONCAT, next_chunk(storage(a)), b);
+    if (length(a) == 0)
+      retval = rest;
+    else {
+      int buffer = bytes(length(a));
+      memcpy(data(buffer), chars(a), length(a));
+      set_field2(buffer, rest);
+      retval = string(buffer, 0);
+    };
+  };
+  return retval;
+}
+
+// Apply a primitive operation to the values of its operands.  Falls back to
+// the lambda terms if the operands are not numbers (i.e. lists of bits) or
+// strings or if the result is not a natural number.  The second operand of
+// concat is not evaluated (it is a thunk or a value).
+int operate(op_t opcode, int a, int b)
+{
+  int retval = -1;
+  if (opcode <= MUL) {
+    if (is_natural(a) && is_natural(b))
+      retval = arith(opcode, a, b);
+  } else if (opcode == CONCAT)
+    retval = append_bytes(a, b);
+  else if (opcode == DROP) {
+    if (is_type(b, INTEGER))
+      retval = drop_bytes(a, intval(b));
+  } else if (opcode >= SEQ)
+    retval = b;
+  else if (is_type(a, STRING) && is_type(b, STRING) &&
+             is_complete(a) && is_complete(b)) {
+    switch (opcode) {
+    case EQ_STR:
+      retval = length(a) == length(b) && !memcmp(chars(a), chars(b), length(a)) ? t() : f();
+      break;
+    default:
+      retval = find_bytes(a, b);
+      if (retval < 0)
+        retval = f();
+    };
+  };
+  if (retval < 0) {
+    switch (opcode) {
+    case ADD:
+      retval = add_list(a, b);
+      break;
+    case SUB:
+      retval = sub_list(a, b);
+      break;
+    case MUL:
+      retval = mul_list(a, b);
+      break;
+    case EQ_STR:
+      retval = call2(eq_str_list_, a, b);
+      break;
+    case CONCAT:
+      retval = call2(concat_list_, a, b);
+      break;
+    case FIND:
+      retval = call2(find_list_, a, b);
+      break;
+    default:
+      retval = call2(drop_list_, a, b);
+    };
+  };
+  return retval;
+}
+
+// Strictness analysis.  A call which applies a known function (a lambda, a
+// closure, or a recursive function) to as many arguments as it has parameters
+// is annotated with a mask of the arguments which the body certainly
+// evaluates.  Bit j refers to the argument of the j-th call down the spine
+// (starting with the call itself), i.e. to variable j of the body.  The
+// evaluators evaluate these arguments before the call instead of allocating
+// thunks.  Only arguments which are calls or operations are annotated
+// because the others are cheap to pass lazily.  The mask and a flag marking
+// analysed calls are kept in the upper bits of the tail of the call.
+#define STRICT_BITS 4
+#define MAX_SPINE 32
+#define MAX_STRICT_DEPTH 32
+#define ANALYSED (1u << 31)
+
+static uint32_t strict_mask(int cell)
+{
+  return cells[cell].tail >> FIELD_BITS & ((1u << STRICT_BITS) - 1);
+}
+
+// Collect the arguments of a spine of calls (the argument of the call itself
+// first).  Returns the number of arguments.  Counting stops at MAX_SPINE + 1
+// arguments, i.e. the head of a longer spine is the rest of the spine.
+static int spine(int term, int *args, int *head)
+{
+  int n = 0;
+  while (is_type(term, CALL) && n <= MAX_SPINE) {
+    if (n < MAX_SPINE)
+      args[n] = arg(term);
+    n++;
+    term = fun(term);
+  };
+  *head = term;
+  return n;
+}
+
+// Get the number of parameters and the body of a known function.  The shift is
+// the number of binders between the body and the scope of the function (-1 for
+// a closure).  Returns zero if the function is not known.
+static int parameters(int head, int *inner, int *shift)
+{
+  int retval = 0;
+  int outer = 0;
+  if (is_type(head, PROC)) {
+    head = block(head);
+    retval = 1;
+    outer = -1;
+  } else if (is_type(head, CALL) && fun(head) == recursive_ && is_type(arg(head), LAMBDA)) {
+    head = body(arg(head));
+    outer = 1;
+  } else if (!is_type(head, LAMBDA))
+    return 0;
+  while (is_type(head, LAMBDA)) {
+    head = body(head);
+    retval++;
+  };
+  *inner = head;
+  *shift = outer < 0 ? -1 : retval + outer;
+  return retval;
+}
+
+// The set of variables (below 64) which are certainly evaluated when a term is
+// evaluated.
+static uint64_t strict_vars(int term, int depth)
+{
+  uint64_t retval = 0;
+  if (depth > MAX_STRICT_DEPTH)
+    return retval;
+  int args[MAX_SPINE];
+  int head;
+  int inner;
+  int shift;
+  int n;
+  int k;
+  int i;
+  switch (type(term)) {
+  case VAR:
+    if (idx(term) < 64)
+      retval = (uint64_t)1 << idx(term);
+    break;
+  case OP:
+    // par fixes the order of evaluation so nothing below it is hoisted, the
+    // elements of a pair are not evaluated, and neither is the second operand
+    // of concat.  The lambda terms of find and drop only look at the list
+    // after the other operand.
+    if (opcode(term) == CONCAT)
+      retval = strict_vars(left(term), depth + 1);
+    else if (opcode(term) == FIND || opcode(term) == DROP)
+      retval = strict_vars(right(term), depth + 1);
+    else if (opcode(term) != PAR && opcode(term) != CONS)
+      retval = strict_vars(left(term), depth + 1) | strict_vars(right(term), depth + 1);
+    break;
+  case CALL:
+    n = spine(term, args, &head);
+    k = n <= MAX_SPINE ? parameters(head, &inner, &shift) : 0;
+    if (k == 0 || k > n)
+      retval = strict_vars(head, depth + 1);
+    else {
+      uint64_t forced = strict_vars(inner, depth + 1);
+      if (shift >= 0 && shift < 64)
+        retval = forced >> shift;
+      for (i = 0; i < k && i < 64; i++)
+        if (forced >> i & 1)
+          retval |= strict_vars(args[n - k + i], depth + 1);
+    };
+    break;
+  default:
+    break;
+  };
+  return retval;
+}
+
+// Terms which are still to be analysed (see analyse)
+__thread int *analyse_stack = NULL;
+__thread int analyse_stack_size = 0;
+__thread int n_analyse_stack = 0;
+
+static void analyse_push(int term)
+{
+  if (n_analyse_stack >= analyse_stack_size) {
+    analyse_stack_size = analyse_stack_size ? 2 * analyse_stack_size : 1024;
+    analyse_stack = realloc(analyse_stack, analyse_stack_size * sizeof(int));
+    if (!analyse_stack) {
+      fputs("Out of memory!\n", stderr);
+      abort();
+    };
+  };
+  analyse_stack[n_analyse_stack++] = term;
+}
+
+// Annotate the calls of a term with the arguments which can be evaluated
+// before the call.  Arguments and left operands are analysed later from a
+// stack so that deeply nested terms do not overflow the native stack.  The
+// arguments of a spine are collected once at its root and the calls further
+// down the spine use them (a spine longer than MAX_SPINE is collected again
+// at each call until the rest is short enough).
+void analyse(int term)
+{
+  int args[MAX_SPINE];
+  int head;
+  int inner;
+  int shift;
+  // The current call applies the head to the arguments args[j .. n - 1].
+  int n = 0;
+  int j = 0;
+  int k = 0;
+  int i;
+  for (;;) {
+    int next = -1;
+    if (term >= static_end)
+      switch (type(term)) {
+      case LAMBDA:
+        next = body(term);
+        break;
+      case PROC:
+        next = block(term);
+        break;
+      case OP:
+        analyse_push(left(term));
+        next = right(term);
+        break;
+      case CALL:
+        if (cells[term].tail & ANALYSED)
+          break;
+        cells[term].tail |= ANALYSED;
+        if (j >= n || n > MAX_SPINE) {
+          n = spine(term, args, &head);
+          j = 0;
+          k = n <= MAX_SPINE ? parameters(head, &inner, &shift) : 0;
+        };
+        if (k > 0 && k == n - j) {
+          uint64_t forced = strict_vars(inner, 0);
+          uint32_t mask = 0;
+          for (i = 0; i < STRICT_BITS && i < k; i++)
+            if (forced >> i & 1 && (is_type(args[j + i], CALL) || is_type(args[j + i], OP)))
+              mask |= 1u << i;
+          cells[term].tail |= mask << FIELD_BITS;
+        };
+        analyse_push(arg(term));
+        j++;
+        next = fun(term);
+        break;
+      default:
+        break;
+      };
+    if (next >= 0)
+      term = next;
+    else if (n_analyse_stack > 0) {
+      term = analyse_stack[--n_analyse_stack];
+      n = j = 0;
+    } else
+      break;
+  };
+}
+
+// Simplification of terms before evaluating them.  Terms built by the host and
+// the prelude contain redexes which can be reduced once instead of each time
+// they are evaluated.  Arguments are only substituted if this neither
+// duplicates work nor grows the term: variables and values are substituted
+// everywhere, other arguments only if the variable is used at most once
+// outside of lambdas.  Known booleans and pairs which are applied to a
+// selector are reduced, and lambdas which merely pass their argument on to a
+// function value are replaced with the function.  Applications of pair_ to
+// its elements are kept so that lists built by the host stay hash-consed
+// instead of being copied each time they are simplified.
+#define SIMPLIFY_BUDGET 65536
+#define MAX_SIMPLIFY_DEPTH 1024
+#define MAX_INLINE 256
+
+__thread int simplifying = 0;
+__thread long simplify_budget = 0;
+
+static int is_atomic(int term)
+{
+  return !is_type(term, LAMBDA) && !is_type(term, CALL) && !is_type(term, OP);
+}
+
+// Add an amount to the variables of a term which are free above the cutoff.
+static int lift(int term, int amount, int cutoff)
+{
+  int retval = term;
+  int a;
+  int b;
+  switch (type(term)) {
+  case VAR:
+    if (idx(term) >= cutoff)
+      retval = var(idx(term) + amount);
+    break;
+  case LAMBDA:
+    a = lift(body(term), amount, cutoff + 1);
+    if (a != body(term))
+      retval = lambda(a);
+    break;
+  case CALL:
+    a = lift(fun(term), amount, cutoff);
+    b = lift(arg(term), amount, cutoff);
+    if (a != fun(term) || b != arg(term))
+      retval = call(a, b);
+    break;
+  case OP:
+    a = lift(left(term), amount, cutoff);
+    b = lift(right(term), amount, cutoff);
+    if (a != left(term) || b != right(term))
+      retval = op(opcode(term), a, b);
+    break;
+  default:
+    break;
+  };
+  return retval;
+}
+
+// Replace variable k of a term with a value (removing the binder of k).
+static int substitute(int term, int k, int value)
+{
+  int retval = term;
+  int a;
+  int b;
+  switch (type(term)) {
+  case VAR:
+    if (idx(term) == k)
+      retval = lift(value, k, 0);
+    else if (idx(term) > k)
+      retval = var(idx(term) - 1);
+    break;
+  case LAMBDA:
+    a = substitute(body(term), k + 1, value);
+    if (a != body(term))
+      retval = lambda(a);
+    break;
+  case CALL:
+    a = substitute(fun(term), k, value);
+    b = substitute(arg(term), k, value);
+    if (a != fun(term) || b != arg(term))
+      retval = call(a, b);
+    break;
+  case OP:
+    a = substitute(left(term), k, value);
+    b = substitute(right(term), k, value);
+    if (a != left(term) || b != right(term))
+      retval = op(opcode(term), a, b);
+    break;
+  default:
+    break;
+  };
+  return retval;
+}
+
+// Count the uses of variable k in a term (up to two).  Uses in lambdas and in
+// the operands of par count twice because substituting a term there would
+// evaluate it more than once or prevent sparking it.  Returns -1 if the term
+// is too large to inline.
+static int uses(int term, int k, int *budget)
+{
+  int retval = 0;
+  int a;
+  int b;
+  if (--*budget < 0)
+    return -1;
+  switch (type(term)) {
+  case VAR:
+    retval = idx(term) == k;
+    break;
+  case LAMBDA:
+    retval = uses(body(term), k + 1, budget);
+    if (retval > 0)
+      retval = 2;
+    break;
+  case CALL:
+  case OP:
+    a = uses(is_type(term, CALL) ? fun(term) : left(term), k, budget);
+    b = uses(is_type(term, CALL) ? arg(term) : right(term), k, budget);
+    if (a < 0 || b < 0)
+      return -1;
+    retval = a + b;
+    if (is_type(term, OP) && opcode(term) == PAR && retval > 0)
+      retval = 2;
+    break;
+  default:
+    break;
+  };
+  return retval < 2 ? retval : 2;
+}
+
+// Check whether the next argument can be substituted into a function which
+// is applied to the given number of arguments.  The parameters of the
+// function which receive arguments do not count as lambdas.
+static int is_substitutable(int head, int n, int argument)
+{
+  int k = 0;
+  while (is_type(head, LAMBDA) && k < n) {
+    head = body(head);
+    k++;
+  };
+  int budget = MAX_INLINE;
+  int count = uses(head, k - 1, &budget);
+  return count >= 0 && (is_atomic(argument) || count <= 1);
+}
+
+static int simplify_(int term, int depth);
+
+// Simplify a spine of calls.  The head and the arguments are simplified first,
+// then the head is reduced with the arguments as far as possible.
+static int simplify_call(int term, int depth)
+{
+  int args[MAX_SPINE];
+  int head;
+  int n = spine(term, args, &head);
+  if (n > MAX_SPINE) {
+    int a = simplify_(fun(term), depth + 1);
+    int b = simplify_(arg(term), depth + 1);
+    return a != fun(term) || b != arg(term) ? call(a, b) : term;
+  };
+  int reduced = 0;
+  int i;
+  int tmp = simplify_(head, depth + 1);
+  int changed = tmp != head;
+  head = tmp;
+  for (i = 0; i < n; i++) {
+    tmp = simplify_(args[i], depth + 1);
+    changed = changed || tmp != args[i];
+    args[i] = tmp;
+  };
+  // args[n - 1] is the first argument applied to the head.
+  while (n > 0) {
+    if (head == t() && n >= 2) {
+      head = args[n - 1];
+      n -= 2;
+    } else if (head == f() && n >= 2) {
+      head = args[n - 2];
+      n -= 2;
+    } else if (is_type(head, OP) && opcode(head) == CONS) {
+      head = call2(args[n - 1], right(head), left(head));
+      n--;
+    } else if (is_type(head, LAMBDA) && (head != pair_ || n >= 3) &&
+               is_substitutable(head, n, args[n - 1])) {
+      head = substitute(body(head), 0, args[n - 1]);
+      n--;
+    } else
+      break;
+    reduced = 1;
+  };
+  if (!changed && !reduced)
+    return term;
+  for (i = n - 1; i >= 0; i--)
+    head = call(head, args[i]);
+  // The reductions may have created new redexes.
+  return reduced ? simplify_(head, depth + 1) : head;
+}
+
+static int simplify_(int term, int depth)
+{
+  int retval = term;
+  int a;
+  int b;
+  if (depth > MAX_SIMPLIFY_DEPTH || --simplify_budget < 0)
+    return retval;
+  switch (type(term)) {
+  case LAMBDA:
+    a = simplify_(body(term), depth + 1);
+    b = is_type(a, CALL) ? fun(a) : -1;
+    // A lambda which applies a function value to its argument is the function.
+    if (b >= 0 && is_type(arg(a), VAR) && idx(arg(a)) == 0 &&
+        (is_type(b, LAMBDA) || is_type(b, PROC) || is_type(b, TRUE) || is_type(b, FALSE))) {
+      int budget = MAX_INLINE;
+      if (uses(b, 0, &budget) == 0)
+        return lift(b, -1, 0);
+    };
+    if (a != body(term))
+      retval = lambda(a);
+    break;
+  case CALL:
+    retval = simplify_call(term, depth);
+    break;
+  case OP:
+    a = simplify_(left(term), depth + 1);
+    b = simplify_(right(term), depth + 1);
+    if (a != left(term) || b != right(term))
+      retval = op(opcode(term), a, b);
+    break;
+  default:
+    break;
+  };
+  return retval;
+}
+
+int simplify(int term)
+{
+  simplify_budget = SIMPLIFY_BUDGET;
+  return simplify_(term, 0);
+}
+
+static int exhausted(void)
+{
+  return n_steps >= step_limit || cells_allocated() >= cell_limit;
+}
+
+static int owner(int wrap) { return __atomic_load_n(&cells[wrap + 1].head, __ATOMIC_ACQUIRE) & FIELD_MASK; }
+
+// Claim an unevaluated thunk for the current thread (see spark).  Returns 1 if
+// the thread evaluates the thunk, 0 if it was evaluated meanwhile, and -1 if
+// another thread evaluates it.
+static int claim(int wrap)
+{
+  uint32_t *head = &cells[wrap + 1].head;
+  uint32_t old = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+  if ((old & FIELD_MASK) == (uint32_t)thread_mark)
+    return 1;
+  if ((old & FIELD_MASK) ||
+      !__atomic_compare_exchange_n(head, &old, old | thread_mark, 0, __ATOMIC_ACQ_REL,
+                                   __ATOMIC_ACQUIRE))
+    return -1;
+  if (cache(wrap) != wrap) {
+    __atomic_store_n(head, old, __ATOMIC_RELEASE);
+    return 0;
+  };
+  return 1;
+}
+
+// Release the thunks claimed by the frames above base.
+static void release(int base)
+{
+  int i;
+  if (sharing)
+    for (i = base; i < n_frames; i++)
+      if (frames[i].type == UPDATE && owner(frames[i].value) == thread_mark)
+        __atomic_store_n(&cells[frames[i].value + 1].head,
+                         cells[frames[i].value + 1].head & ~FIELD_MASK, __ATOMIC_RELEASE);
+}
+
+// Wait while another thread evaluates a (protected) thunk.  The interpreter
+// collects garbage for the workers meanwhile.  A worker stops waiting when
+// it is cancelled and the interpreter when its budget is exhausted.
+static void await(int *wrap)
+{
+  while (cache(*wrap) == *wrap && owner(*wrap) && owner(*wrap) != thread_mark &&
+         n_steps < step_limit) {
+    if (interrupted())
+      gc();
+    else
+      sched_yield();
+  };
+}
+
+// Suspend an evaluation by turning the expression, the environment, and the
+// frames above base into an expression which continues it.
+static int suspend(int cell, int env, int base)
+{
+  int retval = call(capture(base), wrap(cell, env));
+  release(base);
+  n_frames = base;
+  return retval;
+}
+
+static int start_pool(void);
+
+// Spark the thunk a variable is bound to unless it was evaluated or claimed
+// already.  The first spark starts the pool of workers.
+static void spark(int term, int env)
+{
+  if (workers <= 0 || !is_type(term, VAR) || !is_type(env, ENV))
+    return;
+  int wrap = env_lookup(env, idx(term));
+  if (wrap < 0 || !is_type(wrap, WRAP) || wrap < static_end || cache(wrap) != wrap ||
+      owner(wrap) || (!sharing && !start_pool()))
+    return;
+  mutator_t *m = mutator;
+  pthread_mutex_lock(&pool.lock);
+  if (m->head == m->tail)
+    m->head = m->tail = 0;
+  if (m->tail >= m->size) {
+    m->size = m->size ? 2 * m->size : 64;
+    m->sparks = realloc(m->sparks, m->size * sizeof(int));
+    if (!m->sparks) {
+      fputs("Out of memory!\n", stderr);
+      abort();
+    };
+  };
+  m->sparks[m->tail++] = wrap;
+  n_sparks++;
+  pthread_cond_signal(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+// Arguments which are variables or values are passed by reference instead of
+// wrapping them in a new thunk.
+static int argument(int env, int term)
+{
+  int retval;
+  switch (type(term)) {
+  case VAR:
+    // Unbound variables are only an error if the argument is used.
+    if (is_type(env, ENV) && (retval = env_lookup(env, idx(term))) >= 0)
+      return retval;
+    return wrap(term, env);
+  case LAMBDA:
+    return proc(body(term), env);
+  case CALL:
+  case OP:
+    return wrap(term, env);
+  default:
+    return term;
+  };
+}
+
+// Follow a chain of thunks which were updated with other thunks and point each
+// of them at the end of the chain (a value or a thunk which is not evaluated
+// yet).
+static int resolve(int wrap)
+{
+  int retval = wrap;
+  while (is_type(retval, WRAP) && cache(retval) != retval)
+    retval = cache(retval);
+  while (wrap != retval) {
+    int next = cache(wrap);
+    store(wrap, retval);
+    wrap = next;
+  };
+  return retval;
+}
+
+// Apply a pair or a boolean to the arguments on top of the stack without
+// entering a closure.  A pair passes its elements on to the selector
+// (p s = s first rest) and a boolean selects one of two arguments.  A boolean
+// which is applied to one argument only becomes a closure.
+static int destructure(int cell, int base)
+{
+  int retval;
+  if (is_pair(cell)) {
+    retval = frames[n_frames - 1].value;
+    frames[n_frames - 1].value = rest_(cell);
+    push_frame(APPLY, first_(cell));
+  } else if (n_frames - base >= 2 && frames[n_frames - 2].type == APPLY) {
+    n_frames -= 2;
+    retval = frames[is_type(cell, TRUE) ? n_frames + 1 : n_frames].value;
+  } else if (is_type(cell, TRUE))
+    retval = proc(var(1), extend(f(), frames[--n_frames].value));
+  else {
+    n_frames--;
+    retval = id();
+  };
+  return retval;
+}
+
+int graph_value(int graph);
+int is_suspended(int result);
+
+// Evaluate an expression by walking its tree.
+int walk(int cell, int env, int cc)
+{
+  int retval;
+  int quit = 0;
+  int base = n_frames;
+  int tmp;
+  uint32_t mask;
+  uint32_t pending = 0;
+  reinstate(cc);
+  while (!quit) {
+    if (n_cells >= gc_threshold || n_steps >= step_limit || (profile && profile_requested) ||
+        interrupted()) {
+      if (exhausted()) {
+        retval = suspend(cell, env, base);
+        quit = 1;
+        continue;
+      };
+      protect(&cell);
+      protect(&env);
+      gc();
+      unprotect(2);
+      if (profile && profile_requested)
+        profile_dump();
+    };
+    n_steps++;
+    if (profile)
+      profile_steps[type(cell)]++;
+    // Strict arguments of a spine are passed on to the next call only.
+    mask = pending;
+    pending = 0;
+    switch (type(cell)) {
+    case VAR:
+      cell = at_(env, idx(cell));
+      break;
+    case LAMBDA:
+      cell = proc(body(cell), env);
+      break;
+    case CALL:
+      mask |= strict_mask(cell);
+      if (mask & 1) {
+        push_frame(ARGUMENT, cell);
+        frames[n_frames - 1].env = env;
+        frames[n_frames - 1].mask = mask >> 1;
+        cell = arg(cell);
+      } else {
+        push_frame(APPLY, argument(env, arg(cell)));
+        pending = mask >> 1;
+        cell = fun(cell);
+      };
+      break;
+    case OP:
+      if (opcode(cell) == PAR) {
+        spark(left(cell), env);
+        cell = right(cell);
+      } else if (opcode(cell) == CONS)
+        cell = pair_value(argument(env, left(cell)), argument(env, right(cell)));
+      else {
+        push_frame(OPERAND, wrap(right(cell), env));
+        frames[n_frames - 1].op = opcode(cell);
+        cell = left(cell);
+      };
+      break;
+    case APP:
+    case COMB:
+      protect(&env);
+      cell = graph_value(cell);
+      unprotect(1);
+      break;
+    case WRAP:
+      if (sharing && cache(cell) == cell && claim(cell) < 0) {
+        protect(&cell);
+        protect(&env);
+        await(&cell);
+        unprotect(2);
+        break;
+      };
+      env = context(cell);
+      if (cache(cell) != cell) {
+        cell = resolve(cell);
+        profile_hits += profile;
+      } else {
+        // A thunk whose value is the value of another thunk becomes an
+        // indirection instead of waiting for the update.
+        if (n_frames > base && frames[n_frames - 1].type == UPDATE)
+          store(frames[--n_frames].value, cell);
+        push_frame(UPDATE, cell);
+        cell = unwrap(cell);
+        profile_misses += profile;
+      };
+      break;
+    case PROC:
+    case CONT:
+    case ISTREAM:
+    case STRING:
+    case BITSTRING:
+    case INTEGER:
+    case BIGNUM:
+    case PAIR:
+    case TRUE:
+    case FALSE:
+      if (n_frames == base) {
+        retval = cell;
+        quit = 1;
+      } else if (frames[n_frames - 1].type == UPDATE)
+        store(frames[--n_frames].value, cell);
+      else if (frames[n_frames - 1].type == OPERAND && frames[n_frames - 1].op == CONCAT) {
+        n_frames--;
+        cell = operate(CONCAT, cell, frames[n_frames].value);
+      } else if (frames[n_frames - 1].type == OPERAND) {
+        tmp = frames[n_frames - 1].value;
+        frames[n_frames - 1].type = OPERATE;
+        frames[n_frames - 1].value = cell;
+        cell = tmp;
+      } else if (frames[n_frames - 1].type == OPERATE) {
+        n_frames--;
+        cell = operate(frames[n_frames].op, frames[n_frames].value, cell);
+      } else if (frames[n_frames - 1].type == ARGUMENT) {
+        tmp = frames[n_frames - 1].value;
+        env = frames[n_frames - 1].env;
+        pending = frames[n_frames - 1].mask;
+        frames[n_frames - 1].type = APPLY;
+        frames[n_frames - 1].value = cell;
+        cell = fun(tmp);
+      } else
+        switch (type(cell)) {
+        case PROC:
+          if (profile)
+            profile_enter(block(cell));
+          env = extend(stack(cell), frames[--n_frames].value);
+          cell = block(cell);
+          break;
+        case CONT:
+          tmp = frames[--n_frames].value;
+          release(base);
+          n_frames = base;
+          reinstate(cell);
+          cell = tmp;
+          break;
+        case PAIR:
+        case TRUE:
+        case FALSE:
+          cell = destructure(cell, base);
+          break;
+        case ISTREAM:
+          cell = read_stream(cell);
+          break;
+        case STRING:
+          cell = read_string(cell);
+          break;
+        case BITSTRING:
+          cell = read_bits(cell);
+          break;
+        default:
+          cell = read_integer(cell);
+        };
+      break;
+    default:
+      fprintf(stderr, "Unexpected expression type '%s' in function 'walk'!\n", type_id(cell));
+      abort();
+    };
+  };
+  return retval;
+}
+
+// The bytecode interpreter compiles the spine of a term (the functions of
+// calls and operations and the bodies of lambdas) to a linear sequence of
+// instructions of a Krivine machine.  The code of a term on the spine is the
+// tail of the code of the enclosing term.  A side table parallel to the cells
+// holds the position of the code of each term plus one.  Instructions refer
+// to cells so the garbage collector keeps the code of the terms which survive
+// and relocates it (see relocate_code).
+// Arguments which are variables, lambdas, or values are pushed without
+// allocating a wrap.  Strict arguments (see analyse) are evaluated before
+// continuing with the next instruction.  The code of the calls further down
+// the spine of a call with strict arguments depends on the call, so it is not
+// shared with other terms.
+typedef enum { PUSH, PUSH_VAR, PUSH_PROC, PUSH_VALUE, SECOND, SPARK, STRICT, GRAB, ACCESS, QUOTE, JUMP } instruction_t;
+
+__thread long profile_instructions[JUMP + 1];
+
+typedef struct { instruction_t instruction; int operand; int term; } instr_t;
+
+__thread int bytecode = 0;
+__thread instr_t *code = NULL;
+__thread int code_size = 0;
+
+static void emit(instruction_t instruction, int operand, int term)
+{
+  if (n_code >= code_size) {
+    code_size = code_size ? 2 * code_size : 4096;
+    code = realloc(code, code_size * sizeof(instr_t));
+    if (!code) {
+      fputs("Out of memory!\n", stderr);
+      abort();
+    };
+  };
+  code[n_code].instruction = instruction;
+  code[n_code].operand = operand;
+  code[n_code].term = term;
+  n_code++;
+}
+
+static instr_t *compile(int term)
+{
+  int retval = n_code;
+  int quit = 0;
+  uint32_t mask;
+  uint32_t pending = 0;
+  while (!quit) {
+    if (!pending && code_index[term]) {
+      emit(JUMP, code_index[term] - 1, term);
+      quit = 1;
+    } else {
+      if (!pending)
+        code_index[term] = n_code + 1;
+      mask = pending;
+      pending = 0;
+      switch (type(term)) {
+      case CALL:
+        mask |= strict_mask(term);
+        pending = mask >> 1;
+        if (mask & 1)
+          emit(STRICT, 0, term);
+        else
+          switch (type(arg(term))) {
+          case VAR:
+            emit(PUSH_VAR, idx(arg(term)), term);
+            break;
+          case LAMBDA:
+            emit(PUSH_PROC, body(arg(term)), term);
+            break;
+          case CALL:
+          case OP:
+            emit(PUSH, arg(term), term);
+            break;
+          default:
+            emit(PUSH_VALUE, arg(term), term);
+          };
+        term = fun(term);
+        break;
+      case OP:
+        if (opcode(term) == PAR) {
+          emit(SPARK, left(term), term);
+          term = right(term);
+        } else if (opcode(term) == CONS) {
+          // The pair is created when the term is entered.
+          emit(QUOTE, term, term);
+          quit = 1;
+        } else {
+          emit(SECOND, right(term), term);
+          term = left(term);
+        };
+        break;
+      case LAMBDA:
+        emit(GRAB, 0, term);
+        term = body(term);
+        break;
+      case VAR:
+        emit(ACCESS, idx(term), term);
+        quit = 1;
+        break;
+      default:
+        emit(QUOTE, term, term);
+        quit = 1;
+      };
+    };
+  };
+  return code + retval;
+}
+
+static instr_t *code_of(int term)
+{
+  return code_index[term] ? code + code_index[term] - 1 : compile(term);
+}
+
+// Keep the code which can still be entered after a garbage collection, i.e.
+// the code of the terms which survived (up to the end of the block) and the
+// code where strict arguments resume.  The operands of an instruction and the
+// instructions following it are part of its term, so the code which is kept
+// is complete.  The code is compacted and the jumps, the side table of the new
+// semispace, and the positions where strict arguments resume are relocated.
+static void relocate_code(ptrdiff_t other, int used)
+{
+  int *old_index = code_index;
+  int *new_index = code_index + other;
+  int *moved = calloc(n_code, sizeof(int));
+  if (!moved) {
+    fputs("Out of memory!\n", stderr);
+    abort();
+  };
+  memset(new_index, 0, static_end * sizeof(int));
+  int i;
+  for (i = 0; i < n_frames; i++)
+    if (frames[i].type == ARGUMENT && frames[i].resume >= 0)
+      moved[frames[i].resume] = 1;
+  int n = 0;
+  int live = 0;
+  for (i = 0; i < n_code; i++) {
+    int term = gc_survivor(code[i].term);
+    // A block ends with a jump, an access, or a quote.
+    live = term >= 0 && (old_index[code[i].term] == i + 1 || moved[i] ||
+                         (live && code[i - 1].instruction != JUMP &&
+                          code[i - 1].instruction != ACCESS && code[i - 1].instruction != QUOTE));
+    if (!live) {
+      moved[i] = -1;
+      continue;
+    };
+    moved[i] = n;
+    if (old_index[code[i].term] == i + 1 && !new_index[term])
+      new_index[term] = n + 1;
+    code[n] = code[i];
+    code[n].term = term;
+    switch (code[n].instruction) {
+    case PUSH:
+    case PUSH_PROC:
+    case PUSH_VALUE:
+    case SECOND:
+    case SPARK:
+    case QUOTE:
+      code[n].operand = gc_survivor(code[n].operand);
+      assert(code[n].operand >= 0);
+      break;
+    case JUMP:
+      // Jumps go backwards to code which was compiled earlier.
+      code[n].operand = moved[code[n].operand];
+      assert(code[n].operand >= 0);
+      break;
+    default:
+      break;
+    };
+    n++;
+  };
+  for (i = 0; i < n_frames; i++)
+    if (frames[i].type == ARGUMENT && frames[i].resume >= 0)
+      frames[i].resume = moved[frames[i].resume];
+  free(moved);
+  memset(old_index, 0, static_end * sizeof(int));
+  madvise(old_index + heap_start, used * sizeof(int), MADV_DONTNEED);
+  n_code = n;
+}
+
+// Bind the arguments on top of the stack to n directly nested lambdas at once.
+// The environment is copied once instead of once per lambda.
+static int extend_frames(int stack, int n)
+{
+  int retval;
+  if (!is_type(stack, ENV) || env_slots(stack) + n > ENV_CHUNK) {
+    for (retval = stack; n > 0; n--)
+      retval = extend(retval, frames[--n_frames].value);
+  } else {
+    int m = env_slots(stack);
+    retval = env(m + n);
+    set_field(retval, field(stack) + n);
+    memcpy(slots(retval) + n, slots(stack), m * sizeof(uint32_t));
+    n_frames -= n;
+    int i;
+    for (i = 0; i < n; i++)
+      slots(retval)[i] = frames[n_frames + i].value;
+  };
+  return retval;
+}
+
+// Evaluate an expression with the bytecode interpreter.  Instructions are
+// dispatched with computed gotos (if supported by the compiler).  Each
+// instruction is a step like the corresponding step of the tree walker, i.e.
+// the step entering a term is its first instruction and a jump is a step
+// together with the instruction it jumps to.
+int execute(int cell, int env, int cc)
+{
+#define COLLECT \
+  (n_cells >= gc_threshold || n_steps >= step_limit || (profile && profile_requested) || \
+   interrupted())
+#ifdef __GNUC__
+  static const void *dispatch[] = {&&push, &&push_var, &&push_proc, &&push_value,
+                                   &&second, &&spark, &&strict, &&grab, &&access, &&quote, &&jump};
+#define FIRST \
+  if (COLLECT) goto collect; \
+  if (profile) profile_instructions[pc->instruction]++; \
+  goto *dispatch[pc->instruction]
+#define NEXT \
+  if (COLLECT) goto collect; \
+  n_steps++; \
+  if (profile) profile_instructions[pc->instruction]++; \
+  goto *dispatch[pc->instruction]
+#else
+#define FIRST goto first
+#define NEXT goto next
+#endif
+  int retval;
+  int base = n_frames;
+  int tmp;
+  instr_t *pc;
+  reinstate(cc);
+  goto enter;
+#ifndef __GNUC__
+first:
+  if (COLLECT)
+    goto collect;
+  goto decode;
+next:
+  if (COLLECT)
+    goto collect;
+  n_steps++;
+decode:
+  if (profile)
+    profile_instructions[pc->instruction]++;
+  switch (pc->instruction) {
+  case PUSH: goto push;
+  case PUSH_VAR: goto push_var;
+  case PUSH_PROC: goto push_proc;
+  case PUSH_VALUE: goto push_value;
+  case SECOND: goto second;
+  case SPARK: goto spark;
+  case STRICT: goto strict;
+  case GRAB: goto grab;
+  case ACCESS: goto access;
+  case QUOTE: goto quote;
+  default: goto jump;
+  };
+#endif
+push:
+  push_frame(APPLY, wrap(pc->operand, env));
+  pc++;
+  NEXT;
+push_var:
+  push_frame(APPLY, argument(env, arg(pc->term)));
+  pc++;
+  NEXT;
+push_proc:
+  push_frame(APPLY, proc(pc->operand, env));
+  pc++;
+  NEXT;
+push_value:
+  push_frame(APPLY, pc->operand);
+  pc++;
+  NEXT;
+second:
+  push_frame(OPERAND, wrap(pc->operand, env));
+  frames[n_frames - 1].op = opcode(pc->term);
+  pc++;
+  NEXT;
+spark:
+  spark(pc->operand, env);
+  pc++;
+  NEXT;
+strict:
+  push_frame(ARGUMENT, pc->term);
+  frames[n_frames - 1].env = env;
+  frames[n_frames - 1].resume = pc + 1 - code;
+  cell = arg(pc->term);
+  goto enter;
+grab:
+  if (n_frames > base && frames[n_frames - 1].type == APPLY) {
+    // The following lambdas take the next arguments as well.
+    for (tmp = 1; pc[tmp].instruction == GRAB && n_frames - tmp > base &&
+                  frames[n_frames - 1 - tmp].type == APPLY; tmp++);
+    if (profile)
+      for (retval = 0; retval < tmp; retval++)
+        profile_enter(body(pc[retval].term));
+    env = extend_frames(env, tmp);
+    n_steps += tmp - 1;
+    pc += tmp;
+    NEXT;
+  };
+  cell = proc(body(pc->term), env);
+  goto value;
+access:
+  cell = at_(env, pc->operand);
+  goto enter;
+quote:
+  cell = pc->operand;
+  goto enter;
+jump:
+  pc = code + pc->operand;
+  FIRST;
+collect:
+  cell = pc->term;
+  if (exhausted())
+    return suspend(cell, env, base);
+  protect(&cell);
+  protect(&env);
+  gc();
+  unprotect(2);
+  if (profile && profile_requested)
+    profile_dump();
+  pc = code_of(cell);
+  NEXT;
+enter:
+  n_steps++;
+  if (profile)
+    profile_steps[type(cell)]++;
+  switch (type(cell)) {
+  case OP:
+    if (opcode(cell) == CONS) {
+      cell = pair_value(argument(env, left(cell)), argument(env, right(cell)));
+      goto value;
+    };
+    pc = code_of(cell);
+    FIRST;
+  case VAR:
+  case LAMBDA:
+  case CALL:
+    pc = code_of(cell);
+    FIRST;
+  case WRAP:
+    if (sharing && cache(cell) == cell && claim(cell) < 0) {
+      protect(&cell);
+      protect(&env);
+      await(&cell);
+      unprotect(2);
+      if (exhausted())
+        return suspend(cell, env, base);
+      goto enter;
+    };
+    env = context(cell);
+    if (cache(cell) != cell) {
+      cell = resolve(cell);
+      profile_hits += profile;
+      if (is_type(cell, WRAP))
+        goto enter;
+      goto value;
+    };
+    profile_misses += profile;
+    if (n_frames > base && frames[n_frames - 1].type == UPDATE)
+      store(frames[--n_frames].value, cell);
+    push_frame(UPDATE, cell);
+    cell = unwrap(cell);
+    goto enter;
+  case APP:
+  case COMB:
+    protect(&env);
+    cell = graph_value(cell);
+    unprotect(1);
+    goto enter;
+  default:
+    goto value;
+  };
+value:
+  switch (type(cell)) {
+  case PROC:
+  case CONT:
+  case ISTREAM:
+  case STRING:
+  case BITSTRING:
+  case INTEGER:
+  case BIGNUM:
+  case PAIR:
+  case TRUE:
+  case FALSE:
+    break;
+  default:
+    fprintf(stderr, "Unexpected expression type '%s' in function 'execute'!\n", type_id(cell));
+    abort();
+  };
+  if (n_frames == base)
+    retval = cell;
+  else if (frames[n_frames - 1].type == UPDATE) {
+    store(frames[--n_frames].value, cell);
+    goto value;
+  } else if (frames[n_frames - 1].type == OPERAND && frames[n_frames - 1].op == CONCAT) {
+    n_frames--;
+    cell = operate(CONCAT, cell, frames[n_frames].value);
+    goto enter;
+  } else if (frames[n_frames - 1].type == OPERAND) {
+    tmp = frames[n_frames - 1].value;
+    frames[n_frames - 1].type = OPERATE;
+    frames[n_frames - 1].value = cell;
+    cell = tmp;
+    goto enter;
+  } else if (frames[n_frames - 1].type == OPERATE) {
+    n_frames--;
+    cell = operate(frames[n_frames].op, frames[n_frames].value, cell);
+    goto enter;
+  } else if (frames[n_frames - 1].type == ARGUMENT) {
+    tmp = frames[n_frames - 1].value;
+    env = frames[n_frames - 1].env;
+    pc = frames[n_frames - 1].resume >= 0 ? code + frames[n_frames - 1].resume : code_of(fun(tmp));
+    frames[n_frames - 1].type = APPLY;
+    frames[n_frames - 1].value = cell;
+    NEXT;
+  } else {
+    switch (type(cell)) {
+    case PROC:
+      if (profile)
+        profile_enter(block(cell));
+      env = extend(stack(cell), frames[--n_frames].value);
+      pc = code_of(block(cell));
+      NEXT;
+    case CONT:
+      tmp = frames[--n_frames].value;
+      release(base);
+      n_frames = base;
+      reinstate(cell);
+      cell = tmp;
+      break;
+    case PAIR:
+    case TRUE:
+    case FALSE:
+      cell = destructure(cell, base);
+      break;
+    case ISTREAM:
+      cell = read_stream(cell);
+      break;
+    case STRING:
+      cell = read_string(cell);
+      break;
+    case BITSTRING:
+      cell = read_bits(cell);
+      break;
+    default:
+      cell = read_integer(cell);
+    };
+    goto enter;
+  };
+#undef NEXT
+#undef FIRST
+#undef COLLECT
+  return retval;
+}
+
+int eval_(int cell, int env, int cc)
+{
+  return bytecode ? execute(cell, env, cc) : walk(cell, env, cc);
+}
+
+// Graph reduction is an alternative to the environment machines.  Terms are
+// translated to combinators by bracket abstraction with Turner's
+// optimizations (S (K p) (K q) = K (p q), S (K p) I = p, S (K p) q = B p q,
+// and S p (K q) = C p q).  The pairs of the prelude become partial
+// applications of the combinator V (V x y f = f x y).  The graph of
+// applications is reduced in place: the root of a redex is overwritten with
+// the result or, if the result is not a new application, with an indirection
+// I x.  Values (numbers, strings, input streams, closures, and thunks) are
+// leaves of the graph which are translated to combinators when they are
+// applied, and operations are combinators which take two arguments.  The
+// graph of a closed lambda is shared within one translation only: the graph
+// is reduced in place, i.e. sharing it with later translations would keep
+// the values of its constant expressions alive.
+__thread int graph_reduction = 0;
+
+static int arity(int combinator)
+{
+  return combinator == COMB_I ? 1 : combinator == COMB_K || combinator >= COMB_OP ? 2 : 3;
+}
+
+// Abstract variable 0 from a term of calls of combinators and values.  The
+// other variables are renumbered.  If the variable does not occur, the
+// renumbered term is returned and used is set to zero.
+static int abstract(int term, int *used)
+{
+  int retval = term;
+  int fun_used;
+  int arg_used;
+  int a;
+  int b;
+  *used = 0;
+  switch (type(term)) {
+  case VAR:
+    if (idx(term) == 0) {
+      retval = comb(COMB_I);
+      *used = 1;
+    } else
+      retval = var(idx(term) - 1);
+    break;
+  case CALL:
+    a = abstract(fun(term), &fun_used);
+    b = abstract(arg(term), &arg_used);
+    *used = fun_used || arg_used;
+    if (!*used)
+      retval = call(a, b);
+    else if (!fun_used && is_type(arg(term), VAR) && idx(arg(term)) == 0)
+      retval = a;
+    else if (!fun_used)
+      retval = call(call(comb(COMB_B), a), b);
+    else if (!arg_used)
+      retval = call(call(comb(COMB_C), a), b);
+    else
+      retval = call(call(comb(COMB_S), a), b);
+    break;
+  default:
+    break;
+  };
+  return retval;
+}
+
+// Convert calls to applications of the graph.
+static int graph_of(int term)
+{
+  if (!is_type(term, CALL))
+    return term;
+  int a = graph_of(fun(term));
+  return app(a, graph_of(arg(term)));
+}
+
+static int graph_closure(int proc);
+
+// First cell allocated by the current translation (see graph_index)
+__thread int graph_start = 0;
+
+// Translate a term to combinators.  Variables below the depth are bound by
+// lambdas of the term, the others are looked up in the stack of a closure.
+// The number of the variables of the term which are free is returned in free.
+static int translate(int term, int depth, int stack, int *free)
+{
+  int retval = term;
+  int a;
+  int b;
+  int free_a;
+  int free_b;
+  int used;
+  *free = 0;
+  if (term == pair_)
+    return call(comb(COMB_C), comb(COMB_V));
+  switch (type(term)) {
+  case VAR:
+    // Unbound variables are only an error if they are reduced.
+    retval = idx(term) < depth ? term : argument(stack, var(idx(term) - depth));
+    *free = idx(term) + 1;
+    break;
+  case LAMBDA:
+    if (graph_index[term] > graph_start)
+      return graph_index[term] - 1;
+    a = abstract(translate(body(term), depth + 1, stack, &free_a), &used);
+    retval = used ? a : call(comb(COMB_K), a);
+    *free = free_a > 0 ? free_a - 1 : 0;
+    if (*free == 0) {
+      retval = graph_of(retval);
+      graph_index[term] = retval + 1;
+      n_graphs++;
+    };
+    break;
+  case CALL:
+  case OP:
+    a = translate(is_type(term, CALL) ? fun(term) : left(term), depth, stack, &free_a);
+    b = translate(is_type(term, CALL) ? arg(term) : right(term), depth, stack, &free_b);
+    if (is_type(term, OP))
+      a = call(comb(COMB_OP + opcode(term)), a);
+    retval = call(a, b);
+    *free = free_a > free_b ? free_a : free_b;
+    break;
+  case PROC:
+    if (term == id())
+      retval = graph_closure(term);
+    break;
+  case TRUE:
+  case FALSE:
+    retval = graph_closure(term);
+    break;
+  default:
+    break;
+  };
+  return retval;
+}
+
+// Translate a term (or a value) to a graph.
+int combinators(int term)
+{
+  int free;
+  graph_start = n_cells;
+  return graph_of(translate(term, 0, f(), &free));
+}
+
+// The graph of a closure, a pair, or a boolean which is applied.
+static int graph_closure(int proc)
+{
+  int retval;
+  int free;
+  int used;
+  if (proc == t())
+    retval = comb(COMB_K);
+  else if (proc == f())
+    retval = app(comb(COMB_K), comb(COMB_I));
+  else if (proc == id())
+    retval = comb(COMB_I);
+  else if (is_pair(proc))
+    retval = app(app(comb(COMB_V), first_(proc)), rest_(proc));
+  else {
+    retval = abstract(translate(block(proc), 1, stack(proc), &free), &used);
+    retval = graph_of(used ? retval : call(comb(COMB_K), retval));
+  };
+  return retval;
+}
+
+// Follow a chain of indirections and point all of them to its end.
+static int indirect(int cell)
+{
+  int retval = cell;
+  int next;
+  while (is_type(retval, APP) && is_type(app_fun(retval), COMB) &&
+         combinator(app_fun(retval)) == COMB_I)
+    retval = app_arg(retval);
+  while (cell != retval) {
+    next = app_arg(cell);
+    set_field2(cell, retval);
+    cell = next;
+  };
+  return retval;
+}
+
+// The graph of a value which is applied.
+static int graph_leaf(int value)
+{
+  int retval;
+  int free;
+  graph_start = n_cells;
+  switch (type(value)) {
+  case PROC:
+  case PAIR:
+  case TRUE:
+  case FALSE:
+    retval = graph_closure(value);
+    break;
+  case WRAP:
+    // A thunk is translated in its environment.  It is updated with the graph
+    // so that the leaves which refer to it share the reductions.  A variable
+    // is looked up like the environment machines do (unbound variables of
+    // lambdas become such thunks).
+    if (cache(value) != value)
+      retval = resolve(value);
+    else {
+      retval = unwrap(value);
+      if (is_type(retval, VAR))
+        retval = at_(context(value), idx(retval));
+      retval = indirect(graph_of(translate(retval, 0, context(value), &free)));
+      if (value >= static_end)
+        store(value, retval);
+    };
+    break;
+  case CONT:
+    fputs("Continuations are not supported by the graph reducer!\n", stderr);
+    abort();
+  case ISTREAM:
+    retval = combinators(read_stream(value));
+    break;
+  case STRING:
+    retval = combinators(read_string(value));
+    break;
+  case BITSTRING:
+    retval = combinators(read_bits(value));
+    break;
+  case INTEGER:
+  case BIGNUM:
+    retval = combinators(read_integer(value));
+    break;
+  default:
+    fprintf(stderr, "Unexpected value type '%s' in function 'reduce'!\n", type_id(value));
+    abort();
+  };
+  return retval;
+}
+
+// Overwrite the root of a redex with an application.
+static void update(int root, int fun, int arg)
+{
+  set_field(root, fun);
+  set_field2(root, arg);
+}
+
+// Set when a reduction stopped because a budget is exhausted.
+__thread int graph_suspended = 0;
+
+// Reduce a graph to weak head normal form.  The spine of applications is kept
+// on the stack of frames so that the garbage collector updates it.  Returns a
+// value, a combinator, or a partial application of a combinator.  If a budget
+// is exhausted, the reductions so far remain in the graph and its root is
+// returned (nested reductions stop as well).  Only reductions and leaves count
+// as steps so that a suspended reduction which unwinds the spine again makes
+// progress.
+int reduce(int cell)
+{
+  int base = n_frames;
+  int quit = 0;
+  int n;
+  int c;
+  int root;
+  int a;
+  int b;
+  while (!quit) {
+    if (n_cells >= gc_threshold || n_steps >= step_limit || (profile && profile_requested) ||
+        interrupted()) {
+      if (exhausted()) {
+        graph_suspended = 1;
+        break;
+      };
+      protect(&cell);
+      gc();
+      unprotect(1);
+      if (profile && profile_requested)
+        profile_dump();
+    };
+    n = n_frames - base;
+    switch (type(cell)) {
+    case APP:
+      if (is_type(app_fun(cell), COMB) && combinator(app_fun(cell)) == COMB_I) {
+        // Skip (and shorten) the indirections.
+        cell = indirect(cell);
+        if (n > 0)
+          set_field(frames[n_frames - 1].value, cell);
+      } else {
+        push_frame(APPLY, cell);
+        cell = app_fun(cell);
+      };
+      break;
+    case COMB:
+      c = combinator(cell);
+      if (n < arity(c)) {
+        quit = 1;
+        break;
+      };
+      n_steps++;
+      if (profile)
+        profile_steps[COMB]++;
+      // The first argument is the argument of the innermost application.
+      // Operations reduce their arguments first (which may move the cells).
+#define ARG(i) app_arg(frames[n_frames - 1 - (i)].value)
+      root = frames[n_frames - arity(c)].value;
+      switch (c) {
+      case COMB_S:
+        a = app(ARG(0), ARG(2));
+        update(root, a, app(ARG(1), ARG(2)));
+        break;
+      case COMB_B:
+        update(root, ARG(0), app(ARG(1), ARG(2)));
+        break;
+      case COMB_C:
+        update(root, app(ARG(0), ARG(2)), ARG(1));
+        break;
+      case COMB_V:
+        update(root, app(ARG(2), ARG(0)), ARG(1));
+        break;
+      case COMB_I:
+      case COMB_K:
+        update(root, comb(COMB_I), indirect(ARG(0)));
+        break;
+      case COMB_OP + SEQ:
+        a = reduce(ARG(0));
+        set_field2(frames[n_frames - 1].value, a);
+        if (!graph_suspended)
+          update(frames[n_frames - 2].value, comb(COMB_I), indirect(ARG(1)));
+        break;
+      case COMB_OP + PAR:
+        update(root, comb(COMB_I), indirect(ARG(1)));
+        break;
+      case COMB_OP + CONS:
+        update(root, app(comb(COMB_V), ARG(0)), ARG(1));
+        break;
+      default:
+        // The first argument is replaced with its value.  The second operand
+        // of concat is passed on as a graph.
+        a = reduce(ARG(0));
+        set_field2(frames[n_frames - 1].value, a);
+        if (graph_suspended)
+          break;
+        b = c == COMB_OP + CONCAT ? ARG(1) : reduce(ARG(1));
+        set_field2(frames[n_frames - 2].value, b);
+        if (graph_suspended)
+          break;
+        a = combinators(operate(c - COMB_OP, ARG(0), b));
+        update(frames[n_frames - 2].value, comb(COMB_I), a);
+      };
+#undef ARG
+      if (graph_suspended) {
+        quit = 1;
+        break;
+      };
+      n_frames -= arity(c);
+      cell = frames[n_frames].value;
+      break;
+    default:
+      if (n == 0 && !is_type(cell, WRAP))
+        quit = 1;
+      else {
+        n_steps++;
+        if (profile)
+          profile_steps[type(cell)]++;
+        cell = graph_leaf(cell);
+        if (n > 0)
+          set_field(frames[n_frames - 1].value, cell);
+      };
+    };
+  };
+  if (n_frames > base) {
+    cell = frames[base].value;
+    n_frames = base;
+  };
+  return cell;
+}
+
+// The lambda term of a combinator.
+static int combinator_term(int combinator)
+{
+  int retval;
+  switch (combinator) {
+  case COMB_S:
+    retval = lambda3(call(call(var(2), var(0)), call(var(1), var(0))));
+    break;
+  case COMB_K:
+    retval = lambda2(var(1));
+    break;
+  case COMB_I:
+    retval = lambda(var(0));
+    break;
+  case COMB_B:
+    retval = lambda3(call(var(2), call(var(1), var(0))));
+    break;
+  case COMB_C:
+    retval = lambda3(call(call(var(2), var(0)), var(1)));
+    break;
+  case COMB_V:
+    retval = lambda3(call(call(var(0), var(2)), var(1)));
+    break;
+  default:
+    retval = lambda2(op(combinator - COMB_OP, var(1), var(0)));
+  };
+  return retval;
+}
+
+// Reduce a graph and convert the result to a value of the environment
+// machines.  Booleans, the identity, and pairs are converted directly.  Other
+// partial applications become closures whose arguments remain graphs (which
+// the environment machines reduce when they are demanded).  A suspended
+// reduction is returned as a call which continues it.
+int graph_value(int graph)
+{
+  int retval = reduce(graph);
+  if (graph_suspended) {
+    graph_suspended = 0;
+    retval = call(id(), retval);
+  } else if (is_type(retval, APP) || is_type(retval, COMB)) {
+    int args[3];
+    int n = 0;
+    int head = retval;
+    while (is_type(head, APP)) {
+      args[n++] = app_arg(head);
+      head = app_fun(head);
+    };
+    int c = combinator(head);
+    if (c == COMB_K && n == 0)
+      retval = t();
+    else if (c == COMB_K && n == 1 && is_type(args[0], COMB) && combinator(args[0]) == COMB_I)
+      retval = f();
+    else if (c == COMB_I)
+      retval = id();
+    else if (c == COMB_V && n == 2)
+      retval = pair_value(args[1], args[0]);
+    else {
+      // The arguments are bound in the environment of the closure.
+      int term = body(combinator_term(c));
+      int env = f();
+      while (n > 0) {
+        env = extend(env, args[--n]);
+        term = body(term);
+      };
+      retval = proc(term, env);
+    };
+  };
+  return retval;
+}
+
+int eval(int cell)
+{
+  if (simplifying)
+    cell = simplify(cell);
+  if (graph_reduction)
+    return graph_value(combinators(cell));
+  return eval_(cell, f(), cont(var(0)));
+}
+
+// Evaluate an expression for at most the given number of steps and allocated
+// cells (zero for no limit).  If a budget is exhausted, the evaluation stops
+// at a safe point and an expression is returned which continues it when it
+// is evaluated.  Values are never calls so that suspended evaluations can be
+// recognized.  A suspension which is not needed any more is simply dropped.
+int eval_budget(int cell, long steps, long cells)
+{
+  step_limit = steps > 0 ? n_steps + steps : LONG_MAX;
+  cell_limit = cells > 0 ? cells_allocated() + cells : LONG_MAX;
+  set_threshold();
+  int retval = eval(cell);
+  step_limit = LONG_MAX;
+  cell_limit = LONG_MAX;
+  set_threshold();
+  return retval;
+}
+
+int is_suspended(int result) { return is_type(result, CALL); }
+
+int is_f(int cell)
+{
+  int retval = eval(op_if(cell, t(), f()));
+  return retval == f();
+}
+
+// Evaluate an element of a pair unless it was evaluated already.
+static int force(int cell)
+{
+  if (is_type(cell, WRAP) && cache(cell) != cell)
+    cell = resolve(cell);
+  return is_type(cell, WRAP) ? eval(cell) : cell;
+}
+
+int to_int(int number)
+{
+  int retval = 0;
+  int shift = 0;
+  int list = eval(number);
+  protect(&list);
+  while (list != f() && !is_type(list, INTEGER)) {
+    int bit;
+    if (is_pair(list)) {
+      bit = force(first_(list));
+      bit = bit == t() ? 1 : bit == f() ? 0 : !is_f(bit);
+      list = force(rest_(list));
+    } else if (is_f(empty(list))) {
+      bit = !is_f(first(list));
+      list = eval(rest(list));
+    } else
+      break;
+    retval |= bit << shift++;
+  };
+  if (is_type(list, INTEGER))
+    retval |= intval(list) << shift;
+  unprotect(1);
+  return retval;
+}
+
+#define BUFSIZE 1024
+__thread char buffer[BUFSIZE];
+
+const char *to_buffer(int list, char *buffer, int bufsize)
+{
+  if (bufsize <= 1) {
+    fputs("Buffer too small!\n", stderr);
+    abort();
+  };
+  protect(&list);
+  int eval_list = eval(list);
+  protect(&eval_list);
+  if (is_type(eval_list, STRING) && is_complete(eval_list) &&
+      length(eval_list) < bufsize) {
+    memcpy(buffer, chars(eval_list), length(eval_list));
+    buffer[length(eval_list)] = '\0';
+  } else if (!is_f(empty(eval_list)))
+    *buffer = '\0';
+  else {
+    *buffer = to_int(first(eval_list));
+    to_buffer(rest(list), buffer + 1, bufsize - 1);
+  };
+  unprotect(2);
+  return buffer;
+}
+
+const char *to_str(int list) { return to_buffer(list, buffer, BUFSIZE); }
+
+__thread int eq_list_ = -1;
+int eq_list(int eq_elem) { return call(eq_list_, eq_elem); }
+__thread int eq_num_ = -1;
+int eq_num(int a, int b) { return call2(eq_num_, a, b); }
+__thread int eq_str_ = -1;
+int eq_str(int a, int b) { return call2(eq_str_, a, b); }
+
+__thread int map_ = -1;
+int map(int list, int fun) { return call2(map_, fun, list); }
+
+// Map a function over a list sparking each element.  The whole list is built
+// (and all sparks are created) as soon as the first pair is demanded.
+__thread int par_map_ = -1;
+int par_map(int list, int fun) { return call2(par_map_, fun, list); }
+
+__thread int inject_;
+int inject(int list, int start, int fun)
+{
+  return call3(inject_, list, start, fun);
+}
+
+__thread int foldleft_;
+int foldleft(int list, int start, int fun)
+{
+  return call3(foldleft_, list, start, fun);
+}
+
+__thread int concat_ = -1;
+int concat(int a, int b) { return call2(concat_, a, b); }
+
+__thread int find_ = -1;
+int find(int haystack, int needle) { return call2(find_, haystack, needle); }
+
+__thread int drop_ = -1;
+int drop(int list, int n) { return call2(drop_, list, n); }
+
+__thread int select_if_ = -1;
+int select_if(int list, int fun) { return call2(select_if_, list, fun); }
+
+__thread int member_ = -1;
+int member(int list, int eq_elem)
+{
+  return call2(member_, list, eq_elem);
+}
+int member_bool(int list)
+{
+  return member(list, eq_bool_);
+}
+int member_num(int list)
+{
+  return member(list, eq_num_);
+}
+int member_str(int list)
+{
+  return member(list, eq_str_);
+}
+
+__thread int lookup_ = -1;
+int lookup(int alist, int eq_elem, int other)
+{
+  return call3(lookup_, alist, eq_elem, other);
+}
+int lookup_bool(int alist, int other)
+{
+  return lookup(alist, eq_bool_, other);
+}
+int lookup_num(int alist, int other)
+{
+  return lookup(alist, eq_num_, other);
+}
+int lookup_str(int alist, int other)
+{
+  return lookup(alist, eq_str_, other);
+}
+
+int keys(int alist)
+{
+  return map(alist, lambda(first(var(0))));
+}
+
+// Write a list of bytes to a stream.  Each element of the list is evaluated
+// only once and integers are written without converting them to bits.
+void output(int expr, FILE *stream)
+{
+  int saved = line_buffered;
+  fflush(stream);
+  output_fd = fileno(stream);
+  line_buffered = line_buffered || isatty(output_fd);
+  int list = eval(expr);
+  protect(&list);
+  int quit = 0;
+  while (!quit) {
+    int c;
+    if (n_cells >= gc_threshold)
+      gc();
+    if (list == f())
+      quit = 1;
+    else if (is_pair(list)) {
+      c = force(first_(list));
+      put_char(is_type(c, INTEGER) ? intval(c) : to_int(c));
+      list = force(rest_(list));
+    } else if (is_type(list, STRING)) {
+      put_bytes(chars(list), length(list));
+      list = next_chunk(storage(list));
+    } else if (is_type(list, ISTREAM))
+      list = read_stream(list);
+    else if (is_type(list, WRAP) || is_type(list, OP) || is_type(list, APP))
+      list = eval(list);
+    else if (is_f(empty(list))) {
+      put_char(to_int(first(list)));
+      list = eval(rest(list));
+    } else
+      quit = 1;
+  };
+  unprotect(1);
+  flush_output();
+  line_buffered = saved;
+}
+
+// Write a list of bits to a stream packing eight bits into each byte (most
+// significant first, true stands for 0).  A trailing partial byte is padded
+// with zeros.  Bit strings at byte boundaries are written without unfolding.
+void output_bits(int expr, FILE *stream)
+{
+  fflush(stream);
+  output_fd = fileno(stream);
+  int list = eval(expr);
+  protect(&list);
+  int byte = 0;
+  int n = 0;
+  int quit = 0;
+  while (!quit) {
+    int bit = -1;
+    if (n_cells >= gc_threshold)
+      gc();
+    if (list == f())
+      quit = 1;
+    else if (is_pair(list)) {
+      int c = force(first_(list));
+      bit = c == t() ? 0 : c == f() ? 1 : is_f(c);
+      list = force(rest_(list));
+    } else if (is_type(list, BITSTRING)) {
+      if (n_bits(list) == 0)
+        list = next_chunk(storage(list));
+      else if (n == 0 && offset(list) % 8 == 0) {
+        put_bytes(data(storage(list)) + offset(list) / 8, n_bits(list) / 8);
+        list = next_chunk(storage(list));
+      } else {
+        bit = bit_at(list);
+        list = bit_string(storage(list), offset(list) + 1);
+      };
+    } else if (is_type(list, ISTREAM))
+      list = read_stream(list);
+    else if (is_f(empty(list))) {
+      bit = is_f(first(list));
+      list = eval(rest(list));
+    } else
+      quit = 1;
+    if (bit >= 0) {
+      byte = byte << 1 | bit;
+      if (++n == 8) {
+        put_char(byte);
+        byte = 0;
+        n = 0;
+      };
+    };
+  };
+  if (n > 0)
+    put_char(byte << (8 - n));
+  unprotect(1);
+  flush_output();
+}
+
+// Programs are loaded from bit streams of binary lambda calculus (00 is a
+// lambda, 01 an application, and 1^n0 the variable n-1) or from a textual de
+// Bruijn form such as "\\ (\\ 1 0) 0".  Bit streams are either text made of
+// zeros and ones or packed into bytes (most significant bit first).
+typedef enum { BLC_BITS, BLC_BYTES, DE_BRUIJN } format_t;
+
+typedef enum { PARSE_LAMBDA, PARSE_CALL, PARSE_PAREN } parse_t;
+
+typedef struct { parse_t type; int term; } parse_frame_t;
+
+__thread parse_frame_t *parse_stack = NULL;
+__thread int parse_stack_size = 0;
+__thread int n_parse_stack = 0;
+
+__thread int parse_depth = 0;
+
+__thread const char *load_error = NULL;
+__thread size_t load_position = 0;
+
+static void parse_push(parse_t type, int term)
+{
+  if (n_parse_stack >= parse_stack_size) {
+    parse_stack_size = parse_stack_size ? 2 * parse_stack_size : 1024;
+    parse_stack = realloc(parse_stack, parse_stack_size * sizeof(parse_frame_t));
+    if (!parse_stack) {
+      fputs("Out of memory!\n", stderr);
+      abort();
+    };
+  };
+  parse_stack[n_parse_stack].type = type;
+  parse_stack[n_parse_stack].term = term;
+  n_parse_stack++;
+}
+
+static int is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+// Get the next bit of a stream or -1 at the end of it.
+static int next_bit(const char *data, size_t size, size_t *pos, format_t format)
+{
+  int retval;
+  if (format == BLC_BYTES)
+    retval = *pos < 8 * size ? (unsigned char)data[*pos / 8] >> (7 - *pos % 8) & 0x1 : -1;
+  else {
+    while (*pos < size && is_space(data[*pos]))
+      (*pos)++;
+    if (*pos >= size)
+      retval = -1;
+    else if (data[*pos] == '0' || data[*pos] == '1')
+      retval = data[*pos] - '0';
+    else {
+      load_error = "Unexpected character";
+      retval = -1;
+    };
+  };
+  if (retval >= 0)
+    (*pos)++;
+  return retval;
+}
+
+static int load_bits(const char *data, size_t size, format_t format)
+{
+  int retval = -1;
+  size_t pos = 0;
+  int depth = 0;
+  while (!load_error && retval < 0) {
+    int bit = next_bit(data, size, &pos, format);
+    int term = -1;
+    if (bit == 0) {
+      bit = next_bit(data, size, &pos, format);
+      if (bit == 0) {
+        parse_push(PARSE_LAMBDA, -1);
+        depth++;
+      } else if (bit == 1)
+        parse_push(PARSE_CALL, -1);
+    } else if (bit == 1) {
+      int n = 0;
+      while ((bit = next_bit(data, size, &pos, format)) == 1)
+        n++;
+      if (n >= depth)
+        load_error = "Unbound variable";
+      else if (bit == 0)
+        term = var(n);
+    };
+    if (bit < 0 && !load_error)
+      load_error = "Unexpected end of program";
+    while (term >= 0) {
+      if (n_parse_stack == 0) {
+        retval = term;
+        term = -1;
+      } else if (parse_stack[n_parse_stack - 1].type == PARSE_LAMBDA) {
+        term = lambda(term);
+        n_parse_stack--;
+        depth--;
+      } else if (parse_stack[n_parse_stack - 1].term < 0) {
+        parse_stack[n_parse_stack - 1].term = term;
+        term = -1;
+      } else
+        term = call(parse_stack[--n_parse_stack].term, term);
+    };
+  };
+  if (format == BLC_BITS && !load_error) {
+    while (pos < size && is_space(data[pos]))
+      pos++;
+    if (pos < size)
+      load_error = "Unexpected character";
+  };
+  load_position = format == BLC_BYTES ? pos / 8 : pos;
+  return retval;
+}
+
+// Add a term to the application being parsed.
+static void parse_apply(int term)
+{
+  int *acc = &parse_stack[n_parse_stack - 1].term;
+  *acc = *acc < 0 ? term : call(*acc, term);
+}
+
+// Complete the lambdas extending to the end of an expression.
+static int parse_close(void)
+{
+  int retval = parse_stack[n_parse_stack - 1].term;
+  while (retval >= 0 && parse_stack[n_parse_stack - 1].type == PARSE_LAMBDA) {
+    n_parse_stack--;
+    parse_depth--;
+    parse_apply(lambda(retval));
+    retval = parse_stack[n_parse_stack - 1].term;
+  };
+  if (retval < 0)
+    load_error = "Expression expected";
+  return retval;
+}
+
+static int load_de_bruijn(const char *data, size_t size)
+{
+  int retval = -1;
+  size_t pos = 0;
+  parse_depth = 0;
+  parse_push(PARSE_PAREN, -1);
+  while (!load_error && pos < size) {
+    char c = data[pos];
+    if (is_space(c))
+      pos++;
+    else if (c == '#') {
+      while (pos < size && data[pos] != '\n')
+        pos++;
+    } else if (c == '\\' || (c == '\xce' && pos + 1 < size && data[pos + 1] == '\xbb')) {
+      parse_push(PARSE_LAMBDA, -1);
+      parse_depth++;
+      pos += c == '\\' ? 1 : 2;
+    } else if (c == '(') {
+      parse_push(PARSE_PAREN, -1);
+      pos++;
+    } else if (c == ')') {
+      int term = parse_close();
+      if (term < 0)
+        ;
+      else if (n_parse_stack <= 1)
+        load_error = "Unexpected ')'";
+      else {
+        n_parse_stack--;
+        parse_apply(term);
+        pos++;
+      };
+    } else if (c >= '0' && c <= '9') {
+      int n = 0;
+      while (pos < size && data[pos] >= '0' && data[pos] <= '9') {
+        if (n < parse_depth)
+          n = 10 * n + data[pos] - '0';
+        pos++;
+      };
+      if (n >= parse_depth)
+        load_error = "Unbound variable";
+      else
+        parse_apply(var(n));
+    } else
+      load_error = "Unexpected character";
+  };
+  if (!load_error) {
+    retval = parse_close();
+    if (n_parse_stack > 1 && !load_error)
+      load_error = "Missing ')'";
+  };
+  load_position = pos;
+  return retval;
+}
+
+// Parse a program.  Returns -1 and sets load_error if the program is invalid.
+int load(const char *data, size_t size, format_t format)
+{
+  load_error = NULL;
+  n_parse_stack = 0;
+  int retval = format == DE_BRUIJN ? load_de_bruijn(data, size) : load_bits(data, size, format);
+  n_parse_stack = 0;
+  if (load_error)
+    return -1;
+  analyse(retval);
+  return retval;
+}
+
+// Load a program from a file mapped into memory.  The format is selected by
+// the extension (".blc" for bits as text, ".Blc" for bytes, de Bruijn form
+// otherwise).
+int load_file(const char *name)
+{
+  int retval = -1;
+  const char *extension = strrchr(name, '.');
+  format_t format = DE_BRUIJN;
+  if (extension && !strcmp(extension, ".blc"))
+    format = BLC_BITS;
+  else if (extension && !strcmp(extension, ".Blc"))
+    format = BLC_BYTES;
+  int fd = open(name, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st)) {
+    load_error = "Could not open file";
+    load_position = 0;
+  } else if (st.st_size == 0)
+    retval = load("", 0, format);
+  else {
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      load_error = "Could not map file";
+      load_position = 0;
+    } else {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      retval = load(data, st.st_size, format);
+      munmap(data, st.st_size);
+    };
+  };
+  if (fd >= 0)
+    close(fd);
+  if (retval >= 0 && simplifying) {
+    retval = simplify(retval);
+    analyse(retval);
+  };
+  return retval;
+}
+
+int eq(int a, int b)
+{
+  int retval;
+  int i;
+  if (a == b)
+    retval = 1;
+  else if (type(a) == type(b)) {
+    switch (type(a)) {
+    case VAR:
+      retval = idx(a) == idx(b);
+      break;
+    case LAMBDA:
+      retval = eq(body(a), body(b));
+      break;
+    case CALL:
+      retval = eq(fun(a), fun(b)) && eq(arg(a), arg(b));
+      break;
+    case PROC:
+      retval = eq(block(a), block(b)) && eq(stack(a), stack(b));
+      break;
+    case WRAP:
+      retval = eq(unwrap(a), unwrap(b)) && eq(context(a), context(b));
+      break;
+    case MEMOIZE:
+      retval = eq(value(a), value(b)) && eq(target(a), target(b));
+      break;
+    case CONT:
+      retval = eq(k(a), k(b));
+      break;
+    case ENV:
+      retval = env_size(a) == env_size(b);
+      for (i = 0; retval && i < env_size(a); i++)
+        retval = eq(env_at(a, i), env_at(b, i));
+      break;
+    case OP:
+      retval = opcode(a) == opcode(b) && eq(left(a), left(b)) && eq(right(a), right(b));
+      break;
+    case INTEGER:
+    case BIGNUM:
+      retval = compare(a, b) == 0;
+      break;
+    case STRING:
+      retval = length(a) == length(b) && !memcmp(chars(a), chars(b), length(a));
+      break;
+    case BITSTRING:
+      retval = storage(a) == storage(b) && offset(a) == offset(b);
+      break;
+    case PAIR:
+      retval = eq(first_(a), first_(b)) && eq(rest_(a), rest_(b));
+      break;
+    case TRUE:
+    case FALSE:
+      retval = 1;
+      break;
+    case COMB:
+      retval = combinator(a) == combinator(b);
+      break;
+    case APP:
+      retval = eq(app_fun(a), app_fun(b)) && eq(app_arg(a), app_arg(b));
+      break;
+    default:
+      abort();
+    }
+  } else
+    retval = 0;
+  return retval;
+}
+
+const char *global_names[] = {"f", "t", "id", "pair", "recursive", "eq_bool",
+                              "even", "odd", "shr", "shl", "add", "sub", "mul",
+                              "eq_list", "eq_num", "eq_str", "map", "inject",
+                              "foldleft", "concat", "select_if", "member",
+                              "lookup", "eq_str_list", "concat_list", "prefix",
+                              "find_list", "find", "drop_list", "drop",
+                              "par_map"};
+
+#define N_GLOBALS (sizeof(global_names) / sizeof(const char *))
+
+// Get a root of the prelude of the current interpreter.  The table is built
+// on each call because the addresses of thread-local variables are not
+// constant.
+static int *global(int i)
+{
+  int *globals[] = {&f_, &t_, &id_, &pair_, &recursive_, &eq_bool_, &even_,
+                    &odd_, &shr_, &shl_, &add_, &sub_, &mul_, &eq_list_,
+                    &eq_num_, &eq_str_, &map_, &inject_, &foldleft_, &concat_,
+                    &select_if_, &member_, &lookup_, &eq_str_list_,
+                    &concat_list_, &prefix_, &find_list_, &find_,
+                    &drop_list_, &drop_, &par_map_};
+  assert(sizeof(globals) / sizeof(int *) == N_GLOBALS);
+  return globals[i];
+}
+
+void init(void)
+{
+  int v0 = var(0);
+  int v1 = var(1);
+  int v2 = var(2);
+  int v3 = var(3);
+  int v4 = var(4);
+  f_ = cell(FALSE);
+  t_ = cell(TRUE);
+  id_ = proc(v0, f());
+  pair_ = lambda2(op(CONS, v0, v1));
+  recursive_ = lambda(call(lambda(call(v1, call(v0, v0))),
+                           lambda(call(v1, call(v0, v0)))));
+  eq_bool_ = lambda2(op_if(v0, v1, op_not(v1)));
+  even_ = lambda(op_if(empty(v0), t(), op_not(first(v0))));
+  odd_ = lambda(op_if(empty(v0), f(), first(v0)));
+  shr_ = lambda(op_if(empty(v0), f(), rest(v0)));
+  shl_ = lambda(op_if(empty(v0), f(), pair(f(), v0)));
+  add_ = recursive(lambda3(op_if(op_and(empty(v0), empty(v1)),
+                   op_if(v2, pair(t(), f()), f()),
+                   call(lambda(pair(op_xor(op_xor(odd(v1), odd(v2)), v3),
+                                    v0)),
+                        call3(v3,
+                              shr(v1), shr(v0),
+                              op_if(v2,
+                                    op_or(odd(v0), odd(v1)),
+                                    op_and(odd(v0), odd(v1))))))));
+  sub_ = recursive(lambda3(op_if(op_and(empty(v0), empty(v1)),
+                   op_if(v2, pair(t(), call3(v3, shr(v0), shr(v1), v2)), f()),
+                   call(lambda(op_if(op_xor(op_xor(odd(v1), odd(v2)), v3),
+                                     pair(t(), v0),
+                                     op_if(empty(v0), f(), pair(f(), v0)))),
+                        call3(v3,
+                              shr(v0), shr(v1),
+                              op_if(v2,
+                                    op_or(even(v0), odd(v1)),
+                                    op_and(even(v0), odd(v1))))))));
+  mul_ = recursive(lambda2(op_if(empty(v0),
+                   f(),
+                   call(lambda(op_if(first(v1), add_list(v2, v0), v0)),
+                        shl(call2(v2, v1, shr(v0)))))));
+  eq_list_ = lambda(recursive(lambda2(op_if(op_and(empty(v0), empty(v1)),
+                       t(),
+                       op_if(op_or(empty(v0), empty(v1)),
+                             f(),
+                             op_and(call2(v3, first(v0), first(v1)),
+                                    call2(v2, rest(v0), rest(v1))))))));
+  eq_num_ = eq_list(eq_bool_);
+  eq_str_list_ = eq_list(eq_num_);
+  eq_str_ = lambda2(op(EQ_STR, v0, v1));
+  map_ = recursive(lambda2(op_if(empty(v1),
+                                 f(),
+                                 pair(call(v0, first(v1)),
+                                      call2(v2, v0, rest(v1))))));
+  // Each element is sparked when its pair is demanded.  The rest of the list
+  // is not evaluated (it may be infinite).
+  par_map_ = recursive(lambda2(op_if(empty(v1),
+                                     f(),
+                                     call(lambda(par(v0, pair(v0, call2(v3, v1, rest(v2))))),
+                                          call(v0, first(v1))))));
+  inject_ = recursive(lambda3(op_if(empty(v0),
+                              v1,
+                              call3(v3,
+                                    rest(v0),
+                                    call2(v2, v1, first(v0)),
+                                    v2))));
+  foldleft_ = recursive(lambda3(op_if(empty(v0),
+                                      v1,
+                                      call2(v2,
+                                            call3(v3, rest(v0), v1, v2),
+                                            first(v0)))));
+  concat_list_ = lambda2(foldleft(v0,
+                                  v1,
+                                  lambda2(pair(v1, v0))));
+  concat_ = lambda2(op(CONCAT, v0, v1));
+  prefix_ = recursive(lambda2(op_if(empty(v0),
+                                    t(),
+                                    op_if(empty(v1),
+                                          f(),
+                                          op_and(eq_num(first(v0), first(v1)),
+                                                 call2(v2, rest(v0), rest(v1)))))));
+  find_list_ = recursive(lambda2(op_if(call2(prefix_, v1, v0),
+                                       v0,
+                                       op_if(empty(v0),
+                                             f(),
+                                             call2(v2, rest(v0), v1)))));
+  find_ = lambda2(op(FIND, v0, v1));
+  drop_list_ = recursive(lambda2(op_if(empty(v1),
+                                       v0,
+                                       op_if(empty(v0),
+                                             f(),
+                                             call2(v2, rest(v0), sub(v1, from_int(1)))))));
+  drop_ = lambda2(op(DROP, v0, v1));
+  select_if_ = lambda2(foldleft(v0,
+                                f(),
+                                lambda2(op_if(call(v3, v1),
+                                              pair(v1, v0),
+                                              v0))));
+  member_ = lambda(recursive(lambda2(op_if(empty(v1),
+                   f(),
+                   op_if(call2(v3, first(v1), v0),
+                         t(),
+                         call2(v2, v0, rest(v1)))))));
+  lookup_ = lambda2(recursive(lambda2(op_if(empty(v1),
+                    call(v4, v0),
+                    op_if(call2(v3, first(first(v1)), v0),
+                          rest(first(v1)),
+                          call2(v2, v0, rest(v1)))))));
+  int i;
+  for (i = 0; i < N_GLOBALS; i++) {
+    protect(global(i));
+    if (simplifying)
+      *global(i) = simplify(*global(i));
+    analyse(*global(i));
+  };
+};
+
+// Attribute the blocks of a term of the prelude to one of the globals.
+static void profile_owner(int term, int global)
+{
+  uint32_t mask = profile_size - 1;
+  uint32_t i = hash_cell(term, 0) & mask;
+  while (profile_entries[i].block >= 0 && profile_entries[i].block != term)
+    i = (i + 1) & mask;
+  if (profile_entries[i].block == term && profile_entries[i].owner < 0)
+    profile_entries[i].owner = global;
+  switch (type(term)) {
+  case LAMBDA:
+    profile_owner(body(term), global);
+    break;
+  case CALL:
+    profile_owner(fun(term), global);
+    profile_owner(arg(term), global);
+    break;
+  case OP:
+    profile_owner(left(term), global);
+    profile_owner(right(term), global);
+    break;
+  case PROC:
+    profile_owner(block(term), global);
+    break;
+  default:
+    break;
+  };
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  long x = ((const profile_entry_t *)a)->count;
+  long y = ((const profile_entry_t *)b)->count;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+#define PROFILE_TOP 20
+
+// Write the profile as tab-separated lines of a section, a key, and counts.
+// Entries are summed up per global of the prelude ("program" for other
+// blocks) and the most frequently entered blocks are listed by cell.
+void profile_report(FILE *stream)
+{
+  const char *frame_names[] = {"apply", "update", "operand", "operate", "argument"};
+  const char *instruction_names[] = {"push", "push_var", "push_proc", "push_value",
+                                     "second", "spark", "strict", "grab", "access", "quote", "jump"};
+  int i;
+  for (i = 0; i <= APP; i++)
+    if (profile_steps[i])
+      fprintf(stream, "steps\t%s\t%ld\n", type_name(i), profile_steps[i]);
+  for (i = 0; i <= JUMP; i++)
+    if (profile_instructions[i])
+      fprintf(stream, "instructions\t%s\t%ld\n", instruction_names[i], profile_instructions[i]);
+  for (i = 0; i <= APP; i++)
+    if (profile_allocs[i])
+      fprintf(stream, "allocations\t%s\t%ld\t%ld\n", type_name(i), profile_allocs[i], profile_alloc_cells[i]);
+  for (i = 0; i <= ARGUMENT; i++)
+    fprintf(stream, "frames\t%s\t%ld\n", frame_names[i], profile_frames[i]);
+  fprintf(stream, "thunks\thit\t%ld\n", profile_hits);
+  fprintf(stream, "thunks\tmiss\t%ld\n", profile_misses);
+  fprintf(stream, "collections\tcount\t%d\n", n_collections);
+  if (n_profile_entries > 0) {
+    int g;
+    for (g = 0; g < N_GLOBALS; g++)
+      if (*global(g) >= 0)
+        profile_owner(*global(g), g);
+    profile_entry_t *sorted = malloc(n_profile_entries * sizeof(profile_entry_t));
+    long *totals = calloc(N_GLOBALS + 1, sizeof(long));
+    if (!sorted || !totals) {
+      fputs("Out of memory!\n", stderr);
+      abort();
+    };
+    int n = 0;
+    for (i = 0; i < profile_size; i++)
+      if (profile_entries[i].block >= 0) {
+        sorted[n++] = profile_entries[i];
+        totals[profile_entries[i].owner < 0 ? N_GLOBALS : profile_entries[i].owner] += profile_entries[i].count;
+      };
+    qsort(sorted, n, sizeof(profile_entry_t), compare_entries);
+    for (g = 0; g <= N_GLOBALS; g++)
+      if (totals[g])
+        fprintf(stream, "entries\t%s\t%ld\n", g < N_GLOBALS ? global_names[g] : "program", totals[g]);
+    if (profile_collected)
+      fprintf(stream, "entries\tcollected\t%ld\n", profile_collected);
+    for (i = 0; i < n && i < PROFILE_TOP; i++)
+      fprintf(stream, "block\t%d\t%s\t%ld\n", sorted[i].block,
+              sorted[i].owner < 0 ? "program" : global_names[sorted[i].owner], sorted[i].count);
+    free(totals);
+    free(sorted);
+  };
+}
+
+void profile_dump(void)
+{
+  profile_requested = 0;
+  FILE *stream = strcmp(profile_name, "-") ? fopen(profile_name, "w") : stderr;
+  if (!stream) {
+    perror(profile_name);
+    return;
+  };
+  profile_report(stream);
+  if (stream == stderr)
+    fflush(stream);
+  else
+    fclose(stream);
+}
+
+static void request_profile(int signum)
+{
+  (void)signum;
+  profile_requested = 1;
+}
+
+// The interpreter publishes the heap and the roots of the prelude at the end
+// of each collection (see spark).
+static void start_world(void)
+{
+  heap_top = buffer_end = n_cells;
+  pthread_mutex_lock(&pool.lock);
+  pool.cells = cells;
+#ifndef NDEBUG
+  pool.tags = tags;
+#endif
+  pool.heap_end = heap_end;
+  memcpy(pool.small_ints, small_ints, sizeof(small_ints));
+  int i;
+  for (i = 0; i < N_GLOBALS; i++)
+    pool.globals[i] = *global(i);
+  pool.epoch++;
+  pool.stop = pool.collect = 0;
+  interrupt(0);
+  pthread_cond_broadcast(&pool.resume);
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+__thread int epoch = 0;
+
+// A worker picks up the heap after a collection (with the lock held).  Its
+// buffer is gone.
+static void resync(void)
+{
+  if (epoch != pool.epoch) {
+    cells = pool.cells;
+#ifndef NDEBUG
+    tags = pool.tags;
+#endif
+    heap_end = pool.heap_end;
+    memcpy(small_ints, pool.small_ints, sizeof(small_ints));
+    n_small_ints = N_SMALL_INTS;
+    int i;
+    for (i = 0; i < N_GLOBALS; i++)
+      *global(i) = pool.globals[i];
+    n_cells = buffer_end = 0;
+    set_threshold();
+    epoch = pool.epoch;
+  };
+}
+
+// A worker waits at a safe point while the world is stopped, asking for a
+// collection if its buffer is beyond the threshold.  A worker which was
+// cancelled meanwhile gives up at the next safe point.
+static void wait_for_collection(void)
+{
+  pthread_mutex_lock(&pool.lock);
+  if (n_cells >= gc_threshold) {
+    pool.collect = 1;
+    interrupt(1);
+  };
+  pool.n_parked++;
+  pthread_cond_signal(&pool.parked);
+  while (pool.stop || pool.collect)
+    pthread_cond_wait(&pool.resume, &pool.lock);
+  pool.n_parked--;
+  if (mutator->cancel) {
+    mutator->cancel = 0;
+    step_limit = 0;
+  };
+  resync();
+  pthread_mutex_unlock(&pool.lock);
+}
+
+// Take the newest spark of a thread or steal the oldest one of another thread
+// (with the lock held).  Returns -1 if there is none.
+static int take_spark(mutator_t *m)
+{
+  int wrap;
+  while (m->tail > m->head) {
+    wrap = m->sparks[--m->tail];
+    n_sparks--;
+    if (cache(wrap) == wrap && !owner(wrap))
+      return wrap;
+  };
+  int i;
+  for (i = 0; i <= pool.n_workers; i++) {
+    mutator_t *victim = &pool.mutators[i];
+    while (victim->tail > victim->head) {
+      wrap = victim->sparks[victim->head++];
+      n_sparks--;
+      if (cache(wrap) == wrap && !owner(wrap))
+        return wrap;
+    };
+  };
+  return -1;
+}
+
+// Evaluate sparks until the pool is stopped.  A spark which was claimed by
+// another thread meanwhile fizzles.
+static void *work(void *arg)
+{
+  mutator_t *m = arg;
+  mutator = m;
+  thread_mark = m - pool.mutators + 1;
+  is_worker = sharing = 1;
+  hash_consing = 0;
+  m->frames = &frames;
+  m->n_frames = &n_frames;
+  m->roots = roots;
+  m->root_copies = root_copies;
+  m->n_roots = &n_roots;
+  pthread_mutex_lock(&pool.lock);
+  workers = pool.n_workers;
+  static_end = pool.static_end;
+  heap_start = pool.heap_start;
+  reserved = pool.reserved;
+  while (!pool.quit) {
+    int wrap = -1;
+    if (!pool.stop) {
+      resync();
+      wrap = take_spark(m);
+    };
+    if (wrap < 0) {
+      pool.n_parked++;
+      pool.n_idle++;
+      pthread_cond_signal(&pool.parked);
+      pthread_cond_wait(&pool.work, &pool.lock);
+      pool.n_parked--;
+      pool.n_idle--;
+    } else {
+      m->spark = wrap;
+      m->cancel = 0;
+      pthread_mutex_unlock(&pool.lock);
+      step_limit = LONG_MAX;
+      if (claim(wrap) > 0 && !is_suspended(eval_(wrap, f(), cont(var(0)))))
+        __atomic_add_fetch(&n_sparked, 1, __ATOMIC_RELAXED);
+      pthread_mutex_lock(&pool.lock);
+      m->spark = -1;
+    };
+  };
+  pool.n_parked++;
+  pthread_cond_signal(&pool.parked);
+  pthread_mutex_unlock(&pool.lock);
+  free(frames);
+  frames = NULL;
+  frames_size = n_frames = 0;
+  return NULL;
+}
+
+// Start the workers sharing the heap of the interpreter of the current thread
+// unless they work for another interpreter.  Returns zero if they do.
+static int start_pool(void)
+{
+  cell_t *expected = NULL;
+  if (is_worker || !__atomic_compare_exchange_n(&pool.owner, &expected, heap_memory, 0,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return 0;
+  int i;
+  // Workers do not intern small integers.
+  for (i = 0; i < N_SMALL_INTS; i++)
+    from_int(i);
+  reserved = (workers + 1) * BUFFER_SIZE;
+  while (2 * (cells_used() + reserved) > heap_size && grow_heap());
+  if (!pool.globals)
+    pool.globals = malloc(N_GLOBALS * sizeof(int));
+  if (n_cells + GC_MARGIN + reserved > heap_end || !pool.globals) {
+    reserved = 0;
+    set_threshold();
+    __atomic_store_n(&pool.owner, NULL, __ATOMIC_RELEASE);
+    return 0;
+  };
+  // The thunks being evaluated belong to the interpreter.
+  for (i = 0; i < n_frames; i++)
+    if (frames[i].type == UPDATE)
+      set_field(frames[i].value + 1, thread_mark);
+  pool.static_end = static_end;
+  pool.heap_start = heap_start;
+  pool.reserved = reserved;
+  pool.n_workers = workers;
+  pool.n_parked = pool.n_idle = pool.quit = 0;
+  for (i = 0; i <= workers; i++)
+    pool.mutators[i].spark = -1;
+  mutator = &pool.mutators[0];
+  sharing = 1;
+  set_threshold();
+  start_world();
+  for (i = 0; i < workers; i++)
+    if (pthread_create(&pool.threads[i], NULL, work, &pool.mutators[i + 1])) {
+      pthread_mutex_lock(&pool.lock);
+      pool.n_workers = i;
+      pthread_mutex_unlock(&pool.lock);
+      break;
+    };
+  return 1;
+}
+
+// Stop the workers of the interpreter of the current thread (abandoning
+// their sparks).
+static void stop_pool(void)
+{
+  if (!sharing)
+    return;
+  // The workers unwind with the cells left after a collection.
+  gc();
+  stop_world();
+  int i;
+  pthread_mutex_lock(&pool.lock);
+  pool.quit = 1;
+  for (i = 1; i <= pool.n_workers; i++)
+    pool.mutators[i].cancel = 1;
+  pthread_mutex_unlock(&pool.lock);
+  start_world();
+  for (i = 0; i < pool.n_workers; i++)
+    pthread_join(pool.threads[i], NULL);
+  for (i = 0; i <= pool.n_workers; i++)
+    free(pool.mutators[i].sparks);
+  memset(pool.mutators, 0, sizeof(pool.mutators));
+  n_sparks = 0;
+  sharing = 0;
+  reserved = 0;
+  mutator = NULL;
+  n_cells = heap_top < heap_end ? heap_top : heap_end;
+  buffer_end = heap_end;
+  set_threshold();
+  __atomic_store_n(&pool.owner, NULL, __ATOMIC_RELEASE);
+}
+
+// Wait until the workers evaluated all sparks.
+void wait_for_workers(void)
+{
+  while (sharing) {
+    pthread_mutex_lock(&pool.lock);
+    int idle = !n_sparks && pool.n_idle == pool.n_workers;
+    pthread_mutex_unlock(&pool.lock);
+    if (idle)
+      break;
+    if (interrupted())
+      gc();
+    else
+      sched_yield();
+  };
+}
+
+// A heap image holds the cells of the prelude (and optionally of a program)
+// following a header with the indices of the globals.  The cells start at a
+// page boundary of the file so that they can be mapped directly.
+#define IMAGE_MAGIC "BLCIMAGE"
+#define IMAGE_VERSION 2
+#define IMAGE_OFFSET 65536
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t cell_size;
+  uint32_t n_types;
+  uint32_t n_globals;
+  int32_t n_cells;
+  int32_t program;
+  int32_t globals[N_GLOBALS];
+  int32_t small_ints[N_SMALL_INTS];
+} image_t;
+
+// Write the prelude and a program (or -1) to an image file.  Returns zero on
+// success.
+static int write_image(int fd, int program)
+{
+  if (static_end) {
+    fputs("Cannot dump heap restored from an image!\n", stderr);
+    return 1;
+  };
+  protect(&program);
+  // Compact the live cells at the start of the heap.
+  gc();
+  unprotect(1);
+  image_t image;
+  memset(&image, 0, sizeof(image));
+  memcpy(image.magic, IMAGE_MAGIC, sizeof(image.magic));
+  image.version = IMAGE_VERSION;
+  image.cell_size = sizeof(cell_t);
+  image.n_types = APP + 1;
+  image.n_globals = N_GLOBALS;
+  image.n_cells = n_cells;
+  image.program = program;
+  int i;
+  for (i = 0; i < N_GLOBALS; i++)
+    image.globals[i] = *global(i);
+  for (i = 0; i < N_SMALL_INTS; i++)
+    image.small_ints[i] = n_small_ints ? small_ints[i] : -1;
+  size_t size = (size_t)n_cells * sizeof(cell_t);
+  return ftruncate(fd, 0) ||
+         pwrite(fd, &image, sizeof(image), 0) != sizeof(image) ||
+         pwrite(fd, cells, size, IMAGE_OFFSET) != size;
+}
+
+int dump_image(const char *name, int program)
+{
+  int fd = open(name, O_WRONLY | O_CREAT, 0644);
+  int retval = fd < 0 || write_image(fd, program);
+  if (fd >= 0 && close(fd))
+    retval = 1;
+  if (retval)
+    perror(name);
+  return retval;
+}
+
+// The prelude shared by the interpreters of a process (an image file) and the
+// options new interpreters start with.  Both are set before other threads
+// create interpreters.
+typedef struct { int heap_size; int max_heap_size; int huge_pages; int hash_consing;
+                 int bytecode; int workers; int simplifying;
+                 int graph_reduction; } options_t;
+
+int prelude_fd = -1;
+options_t prelude_options;
+
+// Check that the objects of an image have known types and lie within the
+// image, and that their references (see gc_children) are -1 or cells of the
+// image.  Returns nonzero if the cells are valid.
+static int valid_cells(const cell_t *image_cells, int n)
+{
+  int cell = 0;
+  while (cell < n) {
+    const uint32_t *word = &image_cells[cell].head;
+    int type = word[0] >> FIELD_BITS;
+    int first = word[0] & FIELD_MASK;
+    int size;
+    if (type > APP)
+      return 0;
+    if (type == BYTES)
+      size = env_cells(2 * ((first + 7) / 8));
+    else if (type == ENV)
+      size = env_cells(first & ~ENV_LINK);
+    else
+      size = type == BIGNUM ? env_cells(first) : size_of(type);
+    if (size > n - cell)
+      return 0;
+    int valid;
+    switch (type) {
+    case LAMBDA:
+    case CONT:
+    case ISTREAM:
+    case STRING:
+    case BITSTRING:
+      valid = first < n;
+      break;
+    case CALL:
+      valid = first < n && (int)(word[1] & FIELD_MASK) < n;
+      break;
+    case PROC:
+    case MEMOIZE:
+    case OP:
+    case PAIR:
+    case APP:
+      valid = first < n && (int32_t)word[1] >= -1 && (int32_t)word[1] < n;
+      break;
+    case WRAP:
+      valid = first < n && (int32_t)word[1] >= -1 && (int32_t)word[1] < n &&
+              (int32_t)word[3] >= -1 && (int32_t)word[3] < n;
+      break;
+    case ENV: {
+      int i, slots = first & ~ENV_LINK;
+      valid = slots > 0 || !(first & ENV_LINK);
+      for (i = 1; valid && i <= slots; i++)
+        valid = (int32_t)word[i] >= -1 && (int32_t)word[i] < n;
+      break;
+    }
+    case BYTES:
+      valid = (int32_t)word[1] >= -1 && (int32_t)word[1] < n;
+      break;
+    default:
+      valid = 1;
+      break;
+    };
+    if (!valid)
+      return 0;
+    cell += size;
+  };
+  return 1;
+}
+
+// Set up the heap with the cells of an image mapped copy-on-write into the
+// static region.  The image is validated before its cells are used.  Returns
+// the program of the image (or -1).
+static int map_image(int fd, const char *name)
+{
+  image_t image;
+  struct stat st;
+  ssize_t n = pread(fd, &image, sizeof(image), 0);
+  if (n < 0 || fstat(fd, &st)) {
+    perror(name);
+    exit(1);
+  };
+  if (n != sizeof(image)) {
+    fprintf(stderr, "%s: truncated heap image header\n", name);
+    exit(1);
+  };
+  if (memcmp(image.magic, IMAGE_MAGIC, sizeof(image.magic)) ||
+      image.version != IMAGE_VERSION || image.cell_size != sizeof(cell_t) ||
+      image.n_types != APP + 1 || image.n_globals != N_GLOBALS ||
+      image.n_cells <= 0 || image.n_cells > (int)FIELD_MASK) {
+    fprintf(stderr, "%s: incompatible heap image\n", name);
+    exit(1);
+  };
+  if (st.st_size < IMAGE_OFFSET + (off_t)image.n_cells * (off_t)sizeof(cell_t)) {
+    fprintf(stderr, "%s: truncated heap image\n", name);
+    exit(1);
+  };
+  // The program, the globals, the small integers, and the cells themselves
+  // refer to cells of the image (or to -1).
+  int valid = image.program >= -1 && image.program < image.n_cells;
+  int i;
+  for (i = 0; i < N_GLOBALS; i++)
+    valid = valid && image.globals[i] >= -1 && image.globals[i] < image.n_cells;
+  for (i = 0; i < N_SMALL_INTS; i++)
+    valid = valid && image.small_ints[i] >= -1 && image.small_ints[i] < image.n_cells;
+  size_t size = (size_t)image.n_cells * sizeof(cell_t);
+  if (valid) {
+    void *data = mmap(NULL, IMAGE_OFFSET + size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      perror(name);
+      exit(1);
+    };
+    valid = valid_cells((const cell_t *)((char *)data + IMAGE_OFFSET), image.n_cells);
+    munmap(data, IMAGE_OFFSET + size);
+  };
+  if (!valid) {
+    fprintf(stderr, "%s: corrupt heap image\n", name);
+    exit(1);
+  };
+  static_end = image.n_cells;
+  setup_heap();
+  int half;
+  for (half = 0; half < 2; half++)
+    if (mmap(heap_memory + half * half_size(), size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, fd, IMAGE_OFFSET) == MAP_FAILED) {
+      perror(name);
+      exit(1);
+    };
+  for (i = 0; i < N_GLOBALS; i++) {
+    *global(i) = image.globals[i];
+    protect(global(i));
+  };
+  memcpy(small_ints, image.small_ints, sizeof(small_ints));
+  n_small_ints = N_SMALL_INTS;
+  // Make the terms of the image available for hash-consing.
+  if (hash_consing) {
+    int cell;
+    for (cell = 0; cell < static_end; cell += cells_of(cell))
+      switch (type(cell)) {
+      case VAR:
+      case LAMBDA:
+      case CALL:
+      case INTEGER:
+        if (2 * (n_consed + 1) > cons_table_size)
+          rehash(cons_table_size ? 2 * cons_table_size : 4096, keep_all);
+        cons_insert(cell);
+        break;
+      default:
+        break;
+      };
+  };
+  return image.program;
+}
+
+int restore_image(const char *name)
+{
+  int fd = open(name, O_RDONLY);
+  if (fd < 0) {
+    perror(name);
+    exit(1);
+  };
+  prelude_fd = fd;
+  return map_image(fd, name);
+}
+
+// Share the prelude and the options of the interpreter of the current thread
+// with the interpreters created by open_vm.  Unless the prelude was restored
+// from an image, it is written to an anonymous file.  Returns zero on success.
+int share_prelude(void)
+{
+  if (prelude_fd < 0) {
+    int fd = memfd_create("prelude", 0);
+    if (fd < 0 || write_image(fd, -1)) {
+      perror("share_prelude");
+      if (fd >= 0)
+        close(fd);
+      return 1;
+    };
+    prelude_fd = fd;
+  };
+  prelude_options.heap_size = heap_size;
+  prelude_options.max_heap_size = max_heap_size;
+  prelude_options.huge_pages = huge_pages;
+  prelude_options.hash_consing = hash_consing;
+  prelude_options.bytecode = bytecode;
+  prelude_options.workers = workers;
+  prelude_options.simplifying = simplifying;
+  prelude_options.graph_reduction = graph_reduction;
+  return 0;
+}
+
+// Create an interpreter for the current thread.  The state of an interpreter
+// is thread-local so that each thread of a process can run one.  It starts
+// with the shared options and with the cells of the shared prelude mapped
+// copy-on-write into its static region, i.e. the interpreters share the pages
+// of the prelude.
+void open_vm(void)
+{
+  assert(prelude_fd >= 0 && !cells);
+  heap_size = prelude_options.heap_size;
+  max_heap_size = prelude_options.max_heap_size;
+  huge_pages = prelude_options.huge_pages;
+  hash_consing = prelude_options.hash_consing;
+  bytecode = prelude_options.bytecode;
+  workers = prelude_options.workers;
+  simplifying = prelude_options.simplifying;
+  graph_reduction = prelude_options.graph_reduction;
+  map_image(prelude_fd, "prelude");
+}
+
+// Release the memory of the interpreter of the current thread.
+void close_vm(void)
+{
+  stop_pool();
+  size_t reserve = 2 * half_size();
+  // The side tables follow the half of the heap in use.
+  ptrdiff_t half = cells - heap_memory;
+  munmap(heap_memory, reserve * sizeof(cell_t));
+#ifndef NDEBUG
+  munmap(tags - half, reserve * sizeof(const char *));
+  tags = NULL;
+#endif
+  munmap(forwarding - half, reserve * sizeof(int));
+  munmap(code_index - half, reserve * sizeof(int));
+  munmap(graph_index - half, reserve * sizeof(int));
+  free(frames);
+  free(gc_stack);
+  free(scratch);
+  free(cons_table);
+  free(code);
+  free(profile_entries);
+  free(parse_stack);
+  free(analyse_stack);
+  heap_memory = NULL;
+  cells = NULL;
+  forwarding = NULL;
+  code_index = NULL;
+  graph_index = NULL;
+  frames = NULL;
+  frames_size = n_frames = 0;
+  gc_stack = NULL;
+  gc_stack_size = n_gc_stack = 0;
+  scratch = NULL;
+  scratch_size = 0;
+  cons_table = NULL;
+  cons_table_size = n_consed = 0;
+  code = NULL;
+  code_size = n_code = 0;
+  n_graphs = 0;
+  profile_entries = NULL;
+  profile_size = n_profile_entries = 0;
+  parse_stack = NULL;
+  parse_stack_size = n_parse_stack = 0;
+  analyse_stack = NULL;
+  analyse_stack_size = n_analyse_stack = 0;
+  n_roots = 0;
+  n_small_ints = 0;
+  static_end = 0;
+}
+
+double seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Force all bits of a number and return the number of bits.
+int force_bits(int number)
+{
+  int retval = 0;
+  int list = eval(number);
+  protect(&list);
+  while (is_f(empty(list))) {
+    is_f(first(list));
+    list = eval(rest(list));
+    retval++;
+  };
+  unprotect(1);
+  return retval;
+}
+
+// A small interpreter which echoes lines of input without whitespace (the
+// state holds the name being parsed).
+int repl_term(void)
+{
+  return call(recursive(lambda2(op_if(empty(var(0)),
+    op_if(empty(at(var(1), 0)),
+          f(),
+          from_str("Unexpected EOF\n")),
+    call(lookup_num(list4(pair(from_int('\n'),
+                               concat(concat(at(var(1), 0),
+                                             list1(from_int('\n'))),
+                                      call2(var(2),
+                                            rest(var(0)),
+                                            replace(var(1), 0, f())))),
+                          pair(from_int(' '),
+                               call2(var(2),
+                                     rest(var(0)),
+                                     var(1))),
+                          pair(from_int('\t'),
+                               call2(var(2),
+                                     rest(var(0)),
+                                     var(1))),
+                          pair(from_int('='),
+                               from_str("Unexpected '='\n"))),
+                    lambda(call2(var(3),
+                                 rest(var(1)),
+                                 replace(var(2),
+                                         0,
+                                         concat(at(var(2), 0),
+                                                list1(first(var(1)))))))),
+         first(var(0)))))),
+    list1(f()));
+}
 
-int inject_;
-int inject(int list, int start, int fun)
+// Compare native arithmetic with arithmetic on lists of bits.
+void bench_arith(void)
 {
-  return call3(inject_, list, start, fun);
+  int bits[] = {16, 64, 256, 1024};
+  uint32_t value[32];
+  int i, j, k;
+  for (i = 0; i < 32; i++)
+    value[i] = 0x9e3779b9u * (i + 1);
+  printf("operation\tbits\tlist [s]\tnative [s]\tspeedup\n");
+  for (i = 0; i < 2 * sizeof(bits) / sizeof(int); i++) {
+    op_t opcode = i % 2 ? MUL : ADD;
+    int n = bits[i / 2];
+    if (opcode == MUL && n > 256)
+      continue;
+    int a = from_limbs(value, n / 32 ? n / 32 : 1);
+    protect(&a);
+    int b = from_limbs(value + 1, n / 32 ? n / 32 : 1);
+    protect(&b);
+    if (n < 32) {
+      a = from_int(value[0] & 0xffff);
+      b = from_int(value[1] & 0xffff);
+    };
+    int reps = opcode == MUL ? 2 : 20;
+    double start = seconds();
+    for (k = 0; k < reps; k++)
+      force_bits(opcode == ADD ? add_list(a, b) : mul_list(a, b));
+    double list_time = (seconds() - start) / reps;
+    reps = 10000;
+    start = seconds();
+    for (j = 0; j < reps; j++)
+      eval(op(opcode, a, b));
+    double native_time = (seconds() - start) / reps;
+    printf("%s\t%d\t%.3g\t%.3g\t%.0f\n", opcode == ADD ? "add" : "mul", n,
+           list_time, native_time, list_time / native_time);
+    unprotect(2);
+  };
 }
 
-int foldleft_;
-int foldleft(int list, int start, int fun)
+// Compare native string operations with operations on lists of characters.
+void bench_str(void)
 {
-  return call3(foldleft_, list, start, fun);
+  int lengths[] = {16, 256, 4096};
+  printf("operation\tbytes\tlist [s]\tnative [s]\tspeedup\n");
+  int i, j;
+  for (i = 0; i < sizeof(lengths) / sizeof(int); i++) {
+    int n = lengths[i];
+    char *value = malloc(n);
+    if (!value) {
+      fputs("Out of memory!\n", stderr);
+      abort();
+    };
+    for (j = 0; j < n; j++)
+      value[j] = 'a' + j % 26;
+    value[n - 1] = '.';
+    int a = from_bytes(value, n);
+    protect(&a);
+    int b = from_bytes(value, n);
+    protect(&b);
+    int c = from_bytes(value + n - 8, 8);
+    protect(&c);
+    free(value);
+    int reps = 4096 / n;
+    double start = seconds();
+    for (j = 0; j < reps; j++)
+      is_f(call2(eq_str_list_, a, b));
+    double list_time = (seconds() - start) / reps;
+    start = seconds();
+    for (j = 0; j < 10000; j++)
+      is_f(eq_str(a, b));
+    double native_time = (seconds() - start) / 10000;
+    printf("eq_str\t%d\t%.3g\t%.3g\t%.0f\n", n, list_time, native_time, list_time / native_time);
+    start = seconds();
+    for (j = 0; j < reps; j++)
+      is_f(empty(call2(find_list_, a, c)));
+    list_time = (seconds() - start) / reps;
+    start = seconds();
+    for (j = 0; j < 10000; j++)
+      is_f(empty(find(a, c)));
+    native_time = (seconds() - start) / 10000;
+    printf("find\t%d\t%.3g\t%.3g\t%.0f\n", n, list_time, native_time, list_time / native_time);
+    unprotect(3);
+  };
 }
 
-int concat_ = -1;
-int concat(int a, int b) { return call2(concat_, a, b); }
-
-int select_if_ = -1;
-int select_if(int list, int fun) { return call2(select_if_, list, fun); }
-
-int member_ = -1;
-int member(int list, int eq_elem)
+// Compare the tree walker with the bytecode interpreter on a multiplication of
+// lists of bits and on a recursion with strict arguments.  Each workload is
+// measured on its own row (best of five runs).
+void bench_eval(void)
 {
-  return call2(member_, list, eq_elem);
+  int saved = bytecode;
+  uint32_t value[4];
+  int i;
+  for (i = 0; i < 4; i++)
+    value[i] = 0x9e3779b9u * (i + 1);
+  int b = from_limbs(value, 4);
+  protect(&b);
+  int sum = recursive(lambda(op_if(empty(var(0)),
+                                   from_int(0),
+                                   add(var(0), call(var(1), sub(var(0), from_int(1)))))));
+  protect(&sum);
+  printf("evaluation\twalk [s]\tbytecode [s]\tspeedup\n");
+  int workload;
+  for (workload = 0; workload < 2; workload++) {
+    double time[2];
+    for (bytecode = 0; bytecode < 2; bytecode++)
+      for (i = 0; i < 5; i++) {
+        double start = seconds();
+        if (workload == 0)
+          force_bits(mul_list(b, b));
+        else
+          to_int(call(sum, from_int(20000)));
+        double elapsed = seconds() - start;
+        if (i == 0 || elapsed < time[bytecode])
+          time[bytecode] = elapsed;
+      };
+    printf("%s\t%.3g\t%.3g\t%.2f\n", workload ? "recursion" : "mul_list", time[0], time[1],
+           time[0] / time[1]);
+  };
+  unprotect(2);
+  bytecode = saved;
 }
-int member_bool(int list)
+
+// Compare the output driver with decoding each element of a list using the
+// Church encoding.  The list is forced beforehand so that only the decoding is
+// measured.
+void bench_output(void)
 {
-  return member(list, eq_bool_);
+  int n = 1 << 16;
+  char *value = malloc(n);
+  if (!value) {
+    fputs("Out of memory!\n", stderr);
+    abort();
+  };
+  memset(value, 'x', n);
+  int head = eval(map(from_bytes(value, n), lambda(var(0))));
+  protect(&head);
+  free(value);
+  FILE *null = fopen("/dev/null", "w");
+  output(head, null);
+  double start = seconds();
+  int list = head;
+  protect(&list);
+  while (is_f(empty(list))) {
+    fputc(to_int(first(list)), null);
+    list = eval(rest(list));
+  };
+  unprotect(1);
+  double church = seconds() - start;
+  start = seconds();
+  output(head, null);
+  double native = seconds() - start;
+  printf("output\tbytes\tchurch [MB/s]\tnative [MB/s]\tspeedup\n");
+  printf("list\t%d\t%.3g\t%.3g\t%.0f\n", n, n / church * 1e-6, n / native * 1e-6, church / native);
+  fclose(null);
+  unprotect(1);
 }
-int member_num(int list)
+
+FILE *input_file(int n)
 {
-  return member(list, eq_num_);
+  FILE *retval = tmpfile();
+  int i;
+  for (i = 0; i < n; i++)
+    fputc(i % 251, retval);
+  rewind(retval);
+  return retval;
 }
-int member_str(int list)
+
+// The results of the workloads are checked in release builds, too.
+static void check_workload(const char *name, int ok)
 {
-  return member(list, eq_str_);
+  if (!ok) {
+    fprintf(stderr, "Workload %s computed a wrong result!\n", name);
+    exit(1);
+  };
 }
 
-int lookup_ = -1;
-int lookup(int alist, int eq_elem, int other)
+void bench_input(void)
 {
-  return call3(lookup_, alist, eq_elem, other);
+  int n = 1 << 24;
+  FILE *in = input_file(n);
+  FILE *null = fopen("/dev/null", "w");
+  double start = seconds();
+  int list = from_file(in);
+  protect(&list);
+  int i;
+  for (i = 0; i < n / 64; i++) {
+    to_int(first(list));
+    list = eval(rest(list));
+  };
+  double traverse = (seconds() - start) * 64;
+  rewind(in);
+  start = seconds();
+  list = eval(drop(from_file(in), from_int(n - 1)));
+  check_workload("drop", to_int(first(list)) == (n - 1) % 251);
+  double skip = seconds() - start;
+  rewind(in);
+  start = seconds();
+  output(from_file(in), null);
+  double copy = seconds() - start;
+  // The parity of the ones in a smaller input is computed by a program, once
+  // from the bits of integers (where true stands for 1) and once from packed
+  // bits (where false stands for 1).
+  int m = 1 << 16;
+  FILE *small = input_file(m);
+  int odd = 0;
+  int byte;
+  for (i = 0; i < m; i++)
+    for (byte = i % 251; byte; byte >>= 1)
+      odd ^= byte & 1;
+  int parity = lambda2(inject(var(1), var(0), lambda2(op_if(var(1), op_not(var(0)), var(0)))));
+  protect(&parity);
+  start = seconds();
+  list = eval(inject(from_file(small), f(), parity));
+  double expand = seconds() - start;
+  check_workload("parity", is_f(list) == !odd);
+  rewind(small);
+  start = seconds();
+  list = eval(inject(from_bit_file(small), f(), lambda2(op_if(var(1), var(0), op_not(var(0))))));
+  double packed = seconds() - start;
+  check_workload("packed parity", is_f(list) == !odd);
+  unprotect(1);
+  fclose(small);
+  rewind(in);
+  start = seconds();
+  output_bits(from_bit_file(in), null);
+  double copy_bits = seconds() - start;
+  unprotect(1);
+  printf("input\tbytes\ttraverse [MB/s]\tdrop [MB/s]\toutput [MB/s]\n");
+  printf("file\t%d\t%.3g\t%.3g\t%.3g\n", n, n / traverse * 1e-6, n / skip * 1e-6, n / copy * 1e-6);
+  printf("bits\tbytes\tintegers [MB/s]\tpacked [MB/s]\n");
+  printf("parity\t%d\t%.3g\t%.3g\n", m, m / expand * 1e-6, m / packed * 1e-6);
+  printf("bits\tbytes\toutput [MB/s]\n");
+  printf("file\t%d\t%.3g\n", n, n / copy_bits * 1e-6);
+  fclose(null);
+  fclose(in);
 }
-int lookup_bool(int alist, int other)
+
+// Standard workloads for comparing builds.  Each line shows the wall time,
+// the evaluation steps (also per second), the cells allocated, and the peak
+// number of live cells (i.e. the most cells which survived a collection).
+typedef struct { double start; long steps; long allocated; } workload_t;
+
+static workload_t begin_workload(void)
 {
-  return lookup(alist, eq_bool_, other);
+  workload_t retval;
+  // The garbage of the previous workloads does not count.
+  gc();
+  reset_peak();
+  retval.steps = n_steps;
+  retval.allocated = cells_allocated();
+  retval.start = seconds();
+  return retval;
 }
-int lookup_num(int alist, int other)
+
+static void end_workload(const char *name, workload_t w)
 {
-  return lookup(alist, eq_num_, other);
+  double time = seconds() - w.start;
+  long steps = n_steps - w.steps;
+  printf("%s\t%.3f\t%ld\t%.3g\t%ld\t%d\n", name, time, steps, steps / time,
+         cells_allocated() - w.allocated, peak_cells());
+  fflush(stdout);
 }
-int lookup_str(int alist, int other)
+
+// Evaluate the pairs of a list but not its elements.
+static void force_spine(int list)
 {
-  return lookup(alist, eq_str_, other);
+  protect(&list);
+  while (is_f(empty(list)))
+    list = eval(rest(list));
+  unprotect(1);
 }
 
-int keys(int alist)
+// Evaluate the elements of a list of numbers.
+static void force_elements(int list)
 {
-  return map(alist, lambda(first(var(0))));
+  list = eval(list);
+  protect(&list);
+  while (is_f(empty(list))) {
+    force_bits(first(list));
+    list = eval(rest(list));
+  };
+  unprotect(1);
 }
 
-void output(int expr, FILE *stream)
+// Check that a list has n elements equal to a number.
+static int all_equal(int list, int n, int number)
 {
-  int list = eval(expr);
-  while (is_f(empty(list))) {
-    fputc(to_int(first(list)), stream);
+  int retval = 1;
+  list = eval(list);
+  protect(&list);
+  protect(&number);
+  while (retval && is_f(empty(list))) {
+    retval = n-- > 0 && !is_f(eq_num(first(list), number));
     list = eval(rest(list));
   };
+  unprotect(2);
+  return retval && !n;
 }
 
-int eq(int a, int b)
+void bench_workloads(void)
 {
-  int retval;
-  if (a == b)
-    retval = 1;
-  else if (type(a) == type(b)) {
-    switch (type(a)) {
-    case VAR:
-      retval = idx(a) == idx(b);
-      break;
-    case LAMBDA:
-      retval = eq(body(a), body(b));
-      break;
-    case CALL:
-      retval = eq(fun(a), fun(b)) && eq(arg(a), arg(b));
-      break;
-    case PROC:
-      retval = eq(block(a), block(b)) && eq(stack(a), stack(b));
-      break;
-    case WRAP:
-      retval = eq(unwrap(a), unwrap(b)) && eq(context(a), context(b));
-      break;
-    case MEMOIZE:
-      retval = eq(value(a), value(b)) && eq(target(a), target(b));
-      break;
-    case CONT:
-      retval = eq(k(a), k(b));
-      break;
-    default:
-      assert(0);
-    }
-  } else
-    retval = 0;
-  return retval;
+  int i;
+  int result;
+  printf("workload\ttime [s]\tsteps\tsteps/s\tallocated [cells]\tpeak [cells]\n");
+  // addition and multiplication of lists of bits
+  uint32_t value[32];
+  for (i = 0; i < 32; i++)
+    value[i] = 0x9e3779b9u * (i + 1);
+  int a = from_limbs(value, 32);
+  protect(&a);
+  int b = from_limbs(value, 4);
+  protect(&b);
+  workload_t w = begin_workload();
+  for (i = 0; i < 20; i++)
+    force_bits(add_list(a, a));
+  end_workload("add_list", w);
+  w = begin_workload();
+  force_bits(mul_list(b, b));
+  end_workload("mul_list", w);
+  // the same multiplications mapped sequentially and in parallel
+  int factors = f();
+  protect(&factors);
+  for (i = 0; i < 8; i++)
+    factors = pair(b, factors);
+  int saved_workers = workers;
+  workers = 0;
+  // The spine is evaluated first so that par_map sparks all elements before
+  // the first one is demanded.
+  int squares = -1;
+  protect(&squares);
+  w = begin_workload();
+  squares = eval(map(factors, lambda(mul_list(var(0), var(0)))));
+  force_spine(squares);
+  force_elements(squares);
+  end_workload("map", w);
+  workers = saved_workers;
+  int par_squares = -1;
+  protect(&par_squares);
+  w = begin_workload();
+  par_squares = eval(par_map(factors, lambda(mul_list(var(0), var(0)))));
+  force_spine(par_squares);
+  force_elements(par_squares);
+  end_workload("par_map", w);
+  int square = eval(mul(b, b));
+  protect(&square);
+  check_workload("map", all_equal(squares, 8, square));
+  check_workload("par_map", all_equal(par_squares, 8, square));
+  unprotect(6);
+  // concatenation and comparison of lists of bytes
+  char *text = malloc(1 << 12);
+  if (!text) {
+    fputs("Out of memory!\n", stderr);
+    abort();
+  };
+  for (i = 0; i < 1 << 12; i++)
+    text[i] = 'a' + i % 26;
+  int str = map(from_bytes(text, 1 << 12), lambda(var(0)));
+  protect(&str);
+  free(text);
+  w = begin_workload();
+  result = !is_f(eq_str(concat(str, str), concat(str, str)));
+  end_workload("concat_eq_str", w);
+  check_workload("concat_eq_str", result);
+  unprotect(1);
+  // lookup in a long association list
+  int alist = f();
+  protect(&alist);
+  for (i = 0; i < 1000; i++) {
+    char key[16];
+    sprintf(key, "key%d", i);
+    alist = pair(pair(from_str(key), from_int(i)), alist);
+  };
+  w = begin_workload();
+  for (i = 0; i < 100; i++)
+    result = to_int(call(lookup_str(alist, lambda(f())), from_str("key0")));
+  end_workload("lookup_str", w);
+  check_workload("lookup_str", result == 0);
+  unprotect(1);
+  // the REPL over a megabyte of input (it has to run in constant space)
+  FILE *in = tmpfile();
+  int lines = (1 << 20) / strlen("123 456\t789\n");
+  for (i = 0; i < lines; i++)
+    fputs("123 456\t789\n", in);
+  rewind(in);
+  FILE *out = tmpfile();
+  w = begin_workload();
+  output(call(repl_term(), from_file(in)), out);
+  end_workload("repl", w);
+  check_workload("repl", lseek(fileno(out), 0, SEEK_CUR) == (off_t)lines * strlen("123456789\n"));
+  fclose(out);
+  fclose(in);
+  // Church numerals (2^16 computed as 2 2 2 2)
+  int two = lambda2(call(var(1), call(var(1), var(0))));
+  int n = call(call(call(two, two), two), two);
+  protect(&n);
+  w = begin_workload();
+  for (i = 0; i < 10; i++)
+    result = to_int(call(call(n, lambda(add(var(0), from_int(1)))), from_int(0)));
+  end_workload("church", w);
+  check_workload("church", result == 65536);
+  // recursion using the Y combinator
+  int sum = recursive(lambda(op_if(empty(var(0)),
+                                   from_int(0),
+                                   add(var(0), call(var(1), sub(var(0), from_int(1)))))));
+  protect(&sum);
+  w = begin_workload();
+  for (i = 0; i < 10; i++)
+    result = to_int(call(sum, from_int(20000)));
+  end_workload("recursion", w);
+  check_workload("recursion", result == 200010000);
+  unprotect(2);
 }
 
-void init(void)
+// Evaluate some expressions with a new interpreter (see the tests).
+static void *run_vm(void *arg)
 {
-  int v0 = var(0);
-  int v1 = var(1);
-  int v2 = var(2);
-  int v3 = var(3);
-  int v4 = var(4);
-  f_ = proc_self(lambda(v0));
-  t_ = proc(lambda(v1), f());
-  id_ = proc(v0, f());
-  pair_ = lambda3(op_if(v0, v1, v2));
-  recursive_ = lambda(call(lambda(call(v1, call(v0, v0))),
-                           lambda(call(v1, call(v0, v0)))));
-  eq_bool_ = lambda2(op_if(v0, v1, op_not(v1)));
-  even_ = lambda(op_if(empty(v0), t(), op_not(first(v0))));
-  odd_ = lambda(op_if(empty(v0), f(), first(v0)));
-  shr_ = lambda(op_if(empty(v0), f(), rest(v0)));
-  shl_ = lambda(op_if(empty(v0), f(), pair(f(), v0)));
-  add_ = recursive(lambda3(op_if(op_and(empty(v0), empty(v1)),
-                   op_if(v2, pair(t(), f()), f()),
-                   call(lambda(pair(op_xor(op_xor(odd(v1), odd(v2)), v3),
-                                    v0)),
-                        call3(v3,
-                              shr(v1), shr(v0),
-                              op_if(v2,
-                                    op_or(odd(v0), odd(v1)),
-                                    op_and(odd(v0), odd(v1))))))));
-  sub_ = recursive(lambda3(op_if(op_and(empty(v0), empty(v1)),
-                   op_if(v2, pair(t(), call3(v3, shr(v0), shr(v1), v2)), f()),
-                   call(lambda(op_if(op_xor(op_xor(odd(v1), odd(v2)), v3),
-                                     pair(t(), v0),
-                                     op_if(empty(v0), f(), pair(f(), v0)))),
-                        call3(v3,
-                              shr(v0), shr(v1),
-                              op_if(v2,
-                                    op_or(even(v0), odd(v1)),
-                                    op_and(even(v0), odd(v1))))))));
-  mul_ = recursive(lambda2(op_if(empty(v0),
-                   f(),
-                   call(lambda(op_if(first(v1), add(v2, v0), v0)),
-                        shl(call2(v2, v1, shr(v0)))))));
-  eq_list_ = lambda(recursive(lambda2(op_if(op_and(empty(v0), empty(v1)),
-                       t(),
-                       op_if(op_or(empty(v0), empty(v1)),
-                             f(),
-                             op_and(call2(v3, first(v0), first(v1)),
-                                    call2(v2, rest(v0), rest(v1))))))));
-  eq_num_ = eq_list(eq_bool_);
-  eq_str_ = eq_list(eq_num_);
-  map_ = recursive(lambda2(op_if(empty(v1),
-                                 f(),
-                                 pair(call(v0, first(v1)),
-                                      call2(v2, v0, rest(v1))))));
-  inject_ = recursive(lambda3(op_if(empty(v0),
-                              v1,
-                              call3(v3,
-                                    rest(v0),
-                                    call2(v2, v1, first(v0)),
-                                    v2))));
-  foldleft_ = recursive(lambda3(op_if(empty(v0),
-                                      v1,
-                                      call2(v2,
-                                            call3(v3, rest(v0), v1, v2),
-                                            first(v0)))));
-  concat_ = lambda2(foldleft(v0,
-                             v1,
-                             lambda2(pair(v1, v0))));
-  select_if_ = lambda2(foldleft(v0,
-                                f(),
-                                lambda2(op_if(call(v3, v1),
-                                              pair(v1, v0),
-                                              v0))));
-  member_ = lambda(recursive(lambda2(op_if(empty(v1),
-                   f(),
-                   op_if(call2(v3, first(v1), v0),
-                         t(),
-                         call2(v2, v0, rest(v1)))))));
-  lookup_ = lambda2(recursive(lambda2(op_if(empty(v1),
-                    call(v4, v0),
-                    op_if(call2(v3, first(first(v1)), v0),
-                          rest(first(v1)),
-                          call2(v2, v0, rest(v1)))))));
-};
+  int *number = arg;
+  open_vm();
+  int n = *number;
+  int i;
+  for (i = 0; i < 50; i++)
+    *number = to_int(add(mul_list(from_int(n), from_int(n)), from_int(1)));
+  if (strcmp(to_str(map(from_str("abc"), lambda(var(0)))), "abc") || !n_collections)
+    *number = -1;
+  // the workers belong to the interpreter which started them
+  workers = 2;
+  if (to_int(first(rest(par_map(list2(from_int(3), from_int(4)), lambda(var(0)))))) != 4 ||
+      sharing)
+    *number = -1;
+  close_vm();
+  return NULL;
+}
 
 #define assert_equal(a, b) \
   ((void) (eq(a, b) ? 0 : __assert_equal(#a, #b, __FILE__, __LINE__)))
 #define __assert_equal(a, b, file, line) \
   ((void) printf("%s:%u: failed assertion `%s' not equal to `%s'\n", file, line, a, b), abort())
 
-int main(void)
+void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-m cells] [-M cells] [-H] [-N] [-C] [-O] [-G] [-L] [-B] [-w n] [-P file] [-I image] [-D image] [-b] [program]\n"
+                  "  -m cells  initial size of heap, at most 134217728 (BLC_HEAP_SIZE)\n"
+                  "  -M cells  maximum size of heap, at most 134217728 (BLC_MAX_HEAP_SIZE)\n"
+                  "  -H        use transparent huge pages (BLC_HUGE_PAGES)\n"
+                  "  -N        disable hash-consing of terms (BLC_HASH_CONSING=0)\n"
+                  "  -C        use bytecode interpreter (BLC_BYTECODE)\n"
+                  "  -O        simplify terms before evaluating them (BLC_SIMPLIFY)\n"
+                  "  -G        evaluate by graph reduction of combinators (BLC_GRAPH)\n"
+                  "  -L        flush output at each newline (BLC_LINE_BUFFERED)\n"
+                  "  -B        read and write lists of bits packed into bytes (BLC_BIT_IO)\n"
+                  "  -w n      number of worker threads for sparks, at most 64 (BLC_WORKERS)\n"
+                  "  -P file   write profile to file at exit and on SIGUSR1 (BLC_PROFILE)\n"
+                  "  -I image  restore prelude (and program) from heap image (BLC_IMAGE)\n"
+                  "  -D image  dump prelude (and program) to heap image and exit\n"
+                  "  -b        run benchmarks instead of test suite\n"
+                  "  program   apply program to standard input (.blc, .Blc, or de Bruijn form)\n",
+          name);
+}
+
+int main(int argc, char *argv[])
 {
-  init();
-  int n = cell(VAR);
+  const char *env;
+  if ((env = getenv("BLC_HEAP_SIZE")))
+    heap_size = atoi(env);
+  if ((env = getenv("BLC_MAX_HEAP_SIZE")))
+    max_heap_size = atoi(env);
+  if ((env = getenv("BLC_HUGE_PAGES")))
+    huge_pages = atoi(env);
+  if ((env = getenv("BLC_HASH_CONSING")))
+    hash_consing = atoi(env);
+  if ((env = getenv("BLC_BYTECODE")))
+    bytecode = atoi(env);
+  if ((env = getenv("BLC_SIMPLIFY")))
+    simplifying = atoi(env);
+  if ((env = getenv("BLC_GRAPH")))
+    graph_reduction = atoi(env);
+  if ((env = getenv("BLC_LINE_BUFFERED")))
+    line_buffered = atoi(env);
+  if ((env = getenv("BLC_BIT_IO")))
+    bit_io = atoi(env);
+  if ((env = getenv("BLC_WORKERS")))
+    workers = atoi(env);
+  const char *image = getenv("BLC_IMAGE");
+  profile_name = getenv("BLC_PROFILE");
+  const char *dump = NULL;
+  int bench = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:M:HNCOGLBw:P:I:D:b")) != -1) {
+    switch (opt) {
+    case 'm':
+      heap_size = atoi(optarg);
+      break;
+    case 'M':
+      max_heap_size = atoi(optarg);
+      break;
+    case 'H':
+      huge_pages = 1;
+      break;
+    case 'N':
+      hash_consing = 0;
+      break;
+    case 'C':
+      bytecode = 1;
+      break;
+    case 'O':
+      simplifying = 1;
+      break;
+    case 'G':
+      graph_reduction = 1;
+      break;
+    case 'L':
+      line_buffered = 1;
+      break;
+    case 'B':
+      bit_io = 1;
+      break;
+    case 'w':
+      workers = atoi(optarg);
+      break;
+    case 'P':
+      profile_name = optarg;
+      break;
+    case 'I':
+      image = optarg;
+      break;
+    case 'D':
+      dump = optarg;
+      break;
+    case 'b':
+      bench = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    };
+  };
+  if (heap_size <= 0 || heap_size > MAX_HEAP_SIZE || max_heap_size <= 0 ||
+      max_heap_size > MAX_HEAP_SIZE || workers > MAX_WORKERS) {
+    usage(argv[0]);
+    return 1;
+  };
+  // The interpreter keeps one processor busy itself.
+  if (workers < 0)
+    workers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  if (workers > MAX_WORKERS)
+    workers = MAX_WORKERS;
+  int program = -1;
+  if (image && *image)
+    program = restore_image(image);
+  else {
+    setup_heap();
+    init();
+  };
+  if (profile_name && *profile_name) {
+    profile = 1;
+    signal(SIGUSR1, request_profile);
+    atexit(profile_dump);
+  };
+  if (bench) {
+    bench_workloads();
+    bench_arith();
+    bench_str();
+    bench_eval();
+    bench_output();
+    bench_input();
+    return 0;
+  };
+  if (optind < argc) {
+    program = load_file(argv[optind]);
+    if (program < 0) {
+      fprintf(stderr, "%s:%zu: %s\n", argv[optind], load_position, load_error);
+      return 1;
+    };
+  };
+  if (dump)
+    return dump_image(dump, program);
+  if (program >= 0) {
+    protect(&program);
+    if (bit_io)
+      output_bits(call(program, from_bit_file(stdin)), stdout);
+    else
+      output(call(program, from_file(stdin)), stdout);
+    unprotect(1);
+    return 0;
+  };
   // variable
   assert(type(var(0)) == VAR);
   assert(is_type(var(0), VAR));
@@ -774,6 +5874,22 @@ int main(void)
   assert_equal(at_(list3(var(1), var(2), var(3)), 0), var(1));
   assert_equal(at_(list3(var(1), var(2), var(3)), 1), var(2));
   assert_equal(at_(list3(var(1), var(2), var(3)), 2), var(3));
+  // environments
+  assert(type(extend(f(), var(1))) == ENV);
+  assert(is_type(extend(f(), var(1)), ENV));
+  assert(env_size(extend(extend(f(), var(1)), var(2))) == 2);
+  assert_equal(at_(extend(extend(f(), var(1)), var(2)), 0), var(2));
+  assert_equal(at_(extend(extend(f(), var(1)), var(2)), 1), var(1));
+  assert_equal(at_(extend(list2(var(1), var(2)), var(3)), 2), var(2));
+  int deep = f();
+  int depth;
+  for (depth = 0; depth < 3 * ENV_CHUNK; depth++)
+    deep = extend(deep, from_int(depth));
+  assert(env_size(deep) == 3 * ENV_CHUNK);
+  assert(env_slots(deep) <= ENV_CHUNK);
+  assert(to_int(at_(deep, 0)) == 3 * ENV_CHUNK - 1);
+  assert(to_int(at_(deep, 3 * ENV_CHUNK - 1)) == 0);
+  assert(env_lookup(deep, 3 * ENV_CHUNK) < 0);
   // wraps
   assert(type(wrap(var(0), list1(f()))) == WRAP);
   assert(is_type(wrap(var(0), list1(f())), WRAP));
@@ -786,19 +5902,70 @@ int main(void)
   assert(is_type(memoize(var(0), wrap(f(), f())), MEMOIZE));
   assert_equal(value(memoize(var(0), wrap(f(), f()))), var(0));
   assert_equal(target(memoize(var(0), wrap(f(), f()))), wrap(f(), f()));
-  // memoization of values
-  int duplicate = eval(call(lambda(pair(var(0), var(0))), f()));
-  assert(cache(first_(stack(duplicate))) == first_(stack(duplicate)));
-  assert(is_f(eval(first(duplicate))));
-  assert(cache(first_(stack(duplicate))) == f());
-  store(first_(stack(duplicate)), t());
-  assert(!is_f(eval(first(duplicate))));
+  // (the roots of the following tests are released after the loader tests)
+  int test_roots = n_roots;
+  // memoization of values (of arguments which are not atomic); the graph
+  // reducer shares the graph of the argument and updates it in place
+  if (!graph_reduction) {
+    int duplicate = eval(call(lambda(pair(var(0), var(0))), call(id(), f())));
+    protect(&duplicate);
+    assert(cache(first_(duplicate)) == first_(duplicate));
+    assert(is_f(eval(first(duplicate))));
+    assert(cache(first_(duplicate)) == f());
+    store(first_(duplicate), t());
+    assert(!is_f(eval(first(duplicate))));
+    unprotect(1);
+  } else {
+    int duplicate = eval(call(lambda(pair(var(0), var(0))), add(from_int(1), from_int(2))));
+    protect(&duplicate);
+    assert(is_type(first_(duplicate), APP) && is_type(rest_(duplicate), APP));
+    assert(to_int(first(duplicate)) == 3);
+    long steps = n_steps;
+    assert(reduce(rest_(duplicate)) == from_int(3) && n_steps == steps);
+    (void)steps;
+    unprotect(1);
+  };
+  // arguments which are variables share the thunk (or graph) of the variable
+  if (!graph_reduction) {
+    int shared = eval(call(lambda(call(lambda(pair(var(0), var(1))), var(0))), call(id(), f())));
+    assert(first_(shared) == rest_(shared));
+    (void)shared;
+  } else {
+    int shared = eval(call(lambda(call(lambda(pair(var(0), var(1))), var(0))),
+                           add(from_int(1), from_int(2))));
+    protect(&shared);
+    assert(to_int(first(shared)) == 3);
+    long steps = n_steps;
+    assert(reduce(rest_(shared)) == from_int(3) && n_steps == steps);
+    (void)steps;
+    unprotect(1);
+  };
+  // thunks which evaluate to other thunks become indirections (the graph
+  // reducer updates a thunk with its graph instead of its value)
+  int inner = wrap(call(id(), f()), f());
+  protect(&inner);
+  int outer = wrap(var(0), extend(f(), inner));
+  protect(&outer);
+  assert(eval(outer) == f());
+  assert(cache(outer) == inner && is_f(cache(inner)));
+  assert(is_f(force(outer)) && cache(outer) == cache(inner));
+  unprotect(2);
   // procs (closures)
   assert(type(proc(lambda(var(0)), f())) == PROC);
   assert(is_type(proc(lambda(var(0)), f()), PROC));
   assert_equal(block(proc(var(0), f())), var(0));
   assert(is_f_(stack(proc(var(0), f()))));
   assert_equal(stack(proc(var(0), list1(t()))), list1(t()));
+  // pairs and booleans
+  assert(is_type(t(), TRUE) && is_type(f(), FALSE));
+  int cons1 = eval(pair(from_int(2), from_int(3)));
+  protect(&cons1);
+  assert(is_pair(cons1));
+  assert(to_int(first_(cons1)) == 2 && to_int(rest_(cons1)) == 3);
+  assert(to_int(call(cons1, lambda2(add(var(1), var(0))))) == 5);
+  unprotect(1);
+  assert(to_int(call(eval(call(t(), from_int(4))), f())) == 4);
+  assert(eval(call(f(), var(123))) == id());
   // check lazy evaluation
   assert(is_f(call(call(t(), f()), var(123))));
   assert(is_f(call(call(f(), var(123)), f())));
@@ -833,6 +6000,7 @@ int main(void)
   assert(!is_f(at(replace(list3(f(), f(), f()), 2, t()), 2)));
   // Y-combinator
   int last = recursive(lambda(op_if(empty(rest(var(0))), first(var(0)), call(var(1), rest(var(0))))));
+  protect(&last);
   assert(is_f(call(last, list1(f()))));
   assert(!is_f(call(last, list1(t()))));
   assert(is_f(call(last, list2(f(), f()))));
@@ -841,6 +6009,45 @@ int main(void)
   assert(type(cont(var(0))) == CONT);
   assert(is_type(cont(var(0)), CONT));
   assert_equal(k(cont(var(0))), var(0));
+  // (continuations are frames of the environment machines, the graph reducer
+  // does not support them)
+  if (!graph_reduction) {
+    assert(is_f(call(cont(var(0)), f())));
+    assert(!is_f(call(cont(var(0)), t())));
+  };
+  // native stack of frames
+  int cc1 = cont(call(cont(var(0)), call(var(0), wrap(t(), f()))));
+  int base = n_frames;
+  reinstate(cc1);
+  assert(n_frames == base + 1);
+  assert(frames[base].type == APPLY);
+  assert_equal(capture(base), cc1);
+  n_frames = base;
+  assert(!is_f(eval_(id(), f(), cc1)));
+  assert(n_frames == base);
+  // bytecode
+  assert(code_of(call(lambda(var(0)), from_int(1234)))->instruction == PUSH_VALUE);
+  assert(to_int(code_of(call(lambda(var(0)), from_int(1234)))->operand) == 1234);
+  assert(code_of(lambda(var(0)))->instruction == GRAB);
+  assert(code_of(var(0))->instruction == ACCESS);
+  assert(code_of(call(var(1), call(var(0), var(0))))->instruction == PUSH);
+  assert(code_of(call(var(1), var(2)))->instruction == PUSH_VAR);
+  assert(code_of(call(var(1), lambda(var(0))))->instruction == PUSH_PROC);
+  assert(code_of(op(ADD, var(0), var(1)))->instruction == SECOND);
+  int identity = lambda(var(0));
+  int quoted = call(identity, from_int(1234));
+  protect(&identity);
+  protect(&quoted);
+  assert(code_of(identity)->instruction == GRAB);
+  assert(code_of(call(identity, f()))[1].instruction == JUMP);
+  // the garbage collector keeps and relocates the code of surviving terms
+  gc();
+  assert(code_index[identity] && code_index[quoted]);
+  assert(code_of(quoted)->instruction == PUSH_VALUE);
+  assert(code_of(quoted)->operand == arg(quoted));
+  assert(code_of(call(identity, f()))[1].instruction == JUMP);
+  assert(code + code_of(call(identity, f()))[1].operand == code_of(identity));
+  unprotect(2);
   // boolean 'not'
   assert(!is_f(op_not(f())));
   assert(is_f(op_not(t())));
@@ -866,6 +6073,7 @@ int main(void)
   assert(!is_f(eq_bool(t(), t())));
   // numbers
   int x = from_int(2);
+  protect(&x);
   assert(is_f_(first_(read_integer(x))));
   assert(intval(rest_(read_integer(x))) == 1);
   assert(!is_f(first_(read_integer(rest_(read_integer(x))))));
@@ -886,9 +6094,14 @@ int main(void)
   assert(to_int(shr(from_int(77))) == 38);
   // strings
   int str = from_str("ab");
+  protect(&str);
   assert(to_int(first_(read_string(str))) == 'a');
   assert(to_int(first_(read_string(rest_(read_string(str))))) == 'b');
   assert(is_f(read_string(rest_(read_string(rest_(read_string(str)))))));
+  assert(length(from_bytes("a\0b", 3)) == 3);
+  assert(to_int(at(from_bytes("a\0b", 3), 1)) == 0);
+  assert(to_int(at(from_bytes("a\0b", 3), 2)) == 'b');
+  assert(to_int(first_(read_string(from_str("\xff")))) == 255);
   // evaluation of string expressions
   assert(!strcmp(to_str(from_str("abc")), "abc"));
   assert(!strcmp(to_str(call(lambda(list2(var(0), var(0))), from_int('x'))), "xx"));
@@ -905,8 +6118,14 @@ int main(void)
   assert(is_f(eq_str(from_str("ab"), from_str("abc"))));
   assert(is_f(eq_str(from_str("abc"), from_str("ab"))));
   assert(!is_f(eq_str(from_str("abc"), from_str("abc"))));
+  assert(!is_f(eq_str(from_bytes("a\0b", 3), from_bytes("a\0b", 3))));
+  assert(is_f(eq_str(from_bytes("a\0b", 3), from_bytes("a\0c", 3))));
+  assert(!is_f(eq_str(from_str("ab"), list2(from_int('a'), from_int('b')))));
+  assert(is_f(eq_str(list2(from_int('a'), from_int('b')), from_str("ac"))));
+  assert(!is_f(eq_str(rest(from_str("xab")), from_str("ab"))));
   // map
   int maptest = list2(from_int(2), from_int(3));
+  protect(&maptest);
   assert(to_int(at(map(maptest, lambda(shl(var(0)))), 0)) == 4);
   assert(to_int(at(map(maptest, lambda(shl(var(0)))), 1)) == 6);
   // Test injection (fold right)
@@ -933,19 +6152,45 @@ int main(void)
                          lambda2(pair(var(1), var(0))))) == 11);
   // List concatenation
   assert(!strcmp(to_str(concat(from_str("ab"), from_str("cd"))), "abcd"));
+  assert(is_type(eval(concat(from_str("ab"), from_str("cd"))), STRING));
+  assert(!strcmp(to_str(concat(from_str(""), from_str("cd"))), "cd"));
+  assert(!strcmp(to_str(concat(list1(from_int('a')), from_str("b"))), "ab"));
+  assert(!strcmp(to_str(concat(from_str("a"), list1(from_int('b')))), "ab"));
+  // (concat does not evaluate its second operand)
+  int diverge = call(lambda(call(var(0), var(0))), lambda(call(var(0), var(0))));
+  protect(&diverge);
+  assert(to_int(first(concat(list1(from_int('a')), diverge))) == 'a');
+  assert(to_int(first(concat(from_str("a"), diverge))) == 'a');
+  assert(to_int(at(concat(concat(from_str("a"), from_str("b")), diverge), 1)) == 'b');
+  assert(!strcmp(to_str(concat(concat(from_str("a"), call(id(), from_str("b"))), from_str("c"))), "abc"));
+  int lazy_concat = call(lambda(concat(from_str("a"), var(0))), call(id(), diverge));
+  analyse(lazy_concat);
+  assert(strict_mask(lazy_concat) == 0);
+  unprotect(1);
+  // substring search
+  assert(!strcmp(to_str(find(from_str("abcabd"), from_str("abd"))), "abd"));
+  assert(!strcmp(to_str(find(from_str("abc"), from_str(""))), "abc"));
+  assert(!is_f(empty(find(from_str("abc"), from_str("abd")))));
+  assert(!strcmp(to_str(find(list3(from_int('x'), from_int('a'), from_int('b')),
+                             from_str("ab"))), "ab"));
+  assert(!is_f(empty(find(from_str("ab"), list1(from_int('c'))))));
   // select_if
   int is_plus = lambda(eq_num(from_int('+'), var(0)));
+  protect(&is_plus);
   assert(!strcmp(to_str(select_if(from_str("-"), is_plus)), ""));
   assert(!strcmp(to_str(select_if(from_str("+"), is_plus)), "+"));
   assert(!strcmp(to_str(select_if(from_str("a+b+"), is_plus)), "++"));
   int not_plus = lambda(op_not(call(is_plus, var(0))));
+  protect(&not_plus);
   assert(!strcmp(to_str(select_if(from_str("a+b+"), not_plus)), "ab"));
   // member test for boolean list
   int mlist1 = member_bool(list1(f()));
+  protect(&mlist1);
   assert(is_f(call(mlist1, t())));
   assert(!is_f(call(mlist1, f())));
   // member test for integer list
   int mlist2 = member_num(list3(from_int(2), from_int(3), from_int(5)));
+  protect(&mlist2);
   assert(!is_f(call(mlist2, from_int(2))));
   assert(!is_f(call(mlist2, from_int(3))));
   assert(is_f(call(mlist2, from_int(4))));
@@ -954,6 +6199,7 @@ int main(void)
   int mlist3 = member_str(list3(from_str("a"),
                                 from_str("bb"),
                                 from_str("ccc")));
+  protect(&mlist3);
   assert(!is_f(call(mlist3, from_str("a"))));
   assert(!is_f(call(mlist3, from_str("bb"))));
   assert(!is_f(call(mlist3, from_str("ccc"))));
@@ -962,6 +6208,7 @@ int main(void)
   int alist1 = lookup_bool(list2(pair(t(), from_int(1)),
                                  pair(f(), from_int(0))),
                            lambda(f()));
+  protect(&alist1);
   assert(to_int(call(alist1, f())) == 0);
   assert(to_int(call(alist1, t())) == 1);
   // association list with numbers
@@ -969,6 +6216,7 @@ int main(void)
                                 pair(from_int(3), from_int(2)),
                                 pair(from_int(5), from_int(3))),
                           lambda(from_int(0)));
+  protect(&alist2);
   assert(to_int(call(alist2, from_int(2))) == 1);
   assert(to_int(call(alist2, from_int(3))) == 2);
   assert(to_int(call(alist2, from_int(5))) == 3);
@@ -977,6 +6225,7 @@ int main(void)
   int alist3 = lookup_str(list2(pair(from_str("Jan"), from_int(31)),
                                 pair(from_str("Feb"), from_int(28))),
                           lambda(from_int(30)));
+  protect(&alist3);
   assert(to_int(call(alist3, from_str("Jan"))) == 31);
   assert(to_int(call(alist3, from_str("Feb"))) == 28);
   assert(to_int(call(alist3, from_str("Mar"))) == 30);
@@ -986,22 +6235,64 @@ int main(void)
   assert(file(from_file(stdin)) == stdin);
   assert(file(used(from_file(stdin))) == stdin);
   int in1 = from_file(tmpfile());
+  protect(&in1);
   fputs("ab", file(in1));
   rewind(file(in1));
-  assert(to_int(first_(read_stream(in1))) == 'a');
-  assert(to_int(first_(read_stream(rest_(read_stream(in1))))) == 'b');
-  assert(is_f(read_stream(rest_(read_stream(rest_(read_stream(in1)))))));
+  // The stream is read in blocks, i.e. read_stream returns a string of the
+  // bytes read which unfolds into the list of bytes (see read_string).
+  assert(is_type(read_stream(in1), STRING));
+  assert(used(in1) == read_stream(in1));
+  assert(length(read_stream(in1)) == 2);
+  // (the block is read into a chunk which is shrunk to the bytes read)
+  assert(cells_of(storage(read_stream(in1))) == env_cells(2));
+  assert(!is_complete(read_stream(in1)));
+  assert(to_int(first_(read_string(read_stream(in1)))) == 'a');
+  assert(to_int(first_(read_string(rest_(read_string(read_stream(in1)))))) == 'b');
+  assert(is_type(read_string(string(storage(read_stream(in1)), 2)), ISTREAM));
+  assert(is_type(drop_bytes(read_stream(in1), 2), ISTREAM));
+  assert(is_f(read_stream(drop_bytes(read_stream(in1), 2))));
+  assert(to_int(first(in1)) == 'a');
+  assert(to_int(first(rest(in1))) == 'b');
+  assert(is_f(rest(rest(in1))));
+  assert(!strcmp(to_str(concat(in1, from_str("c"))), "abc"));
   fclose(file(in1));
   // integers
   assert(type(from_int(5)) == INTEGER);
   assert(is_type(from_int(5), INTEGER));
   assert(intval(from_int(5)) == 5);
+  assert(intval(from_int(-5)) == -5);
+  assert(intval(from_int(1000000)) == 1000000);
+  assert(from_int('a') == from_int('a'));
+  // hash-consing
+  if (hash_consing) {
+    assert(var(3) == var(3));
+    assert(var(3) != var(4));
+    assert(lambda(var(1)) == lambda(var(1)));
+    assert(call(var(1), var(2)) == call(var(1), var(2)));
+    assert(call(var(1), var(2)) != call(var(2), var(1)));
+    assert(from_int(1000) == from_int(1000));
+    assert(wrap(var(0), f()) != wrap(var(0), f()));
+  };
   // evaluation of input
   int in3 = from_str("abc");
+  protect(&in3);
   assert(to_int(first(in3)) == 'a');
   assert(to_int(first(rest(rest(in3)))) == 'c');
   assert(to_int(first(rest(in3))) == 'b');
   assert(is_f(rest(rest(rest(in3)))));
+  int in4 = from_file(input_file(INPUT_BUFSIZE + 3));
+  protect(&in4);
+  assert(to_int(first(drop(in4, from_int(INPUT_BUFSIZE - 1)))) == (INPUT_BUFSIZE - 1) % 251);
+  assert(to_int(first(drop(in4, from_int(INPUT_BUFSIZE + 1)))) == (INPUT_BUFSIZE + 1) % 251);
+  assert(to_int(first(rest(drop(in4, from_int(INPUT_BUFSIZE - 1))))) == INPUT_BUFSIZE % 251);
+  assert(is_f(drop(in4, from_int(INPUT_BUFSIZE + 3))));
+  assert(is_f(drop(in4, from_int(INPUT_BUFSIZE + 4))));
+  assert(!is_f(eq_str(drop(in4, from_int(INPUT_BUFSIZE + 1)), from_str("FG"))));
+  fclose(file(in4));
+  assert(!is_f(eq_str(drop(in3, from_int(1)), from_str("bc"))));
+  assert(is_f(drop(in3, from_int(4))));
+  assert(to_int(first(drop(pair(from_int(1), pair(from_int(2), f())), from_int(1)))) == 2);
+  assert(to_int(first(drop(in3, pair(f(), pair(t(), f()))))) == 'c');
   // write expression to stream
   FILE *of = tmpfile();
   output(from_str("xy"), of);
@@ -1009,7 +6300,53 @@ int main(void)
   assert(fgetc(of) == 'x');
   assert(fgetc(of) == 'y');
   assert(fgetc(of) == EOF);
+  rewind(of);
+  output(pair(from_int('a'), pair(shl(from_int('b' / 2)), from_str("cd"))), of);
+  output(map(from_str("ef"), lambda(var(0))), of);
+  output(list1(add(from_int('f'), from_int(1))), of);
+  rewind(of);
+  assert(fgets(buffer, BUFSIZE, of) && !strcmp(buffer, "abcdefg"));
+  fclose(of);
+  assert(is_pair(eval(list1(f()))));
+  assert(!is_pair(eval(f())));
+  // packed bits
+  int in5 = from_bit_file(tmpfile());
+  protect(&in5);
+  fputs("\xa0", file(in5));
+  rewind(file(in5));
+  assert(is_type(read_stream(in5), BITSTRING));
+  assert(n_bits(read_stream(in5)) == 8);
+  assert(is_f(first(in5)));
+  assert(!is_f(first(rest(in5))));
+  assert(is_f(first(rest(rest(in5)))));
+  assert(!is_f(at(in5, 7)));
+  assert(is_f(drop(in5, from_int(8))));
+  of = tmpfile();
+  output_bits(list3(f(), t(), f()), of);
+  output_bits(in5, of);
+  output_bits(pair(t(), drop(in5, from_int(1))), of);
+  output_bits(map(in5, lambda(var(0))), of);
+  rewind(of);
+  assert(fgets(buffer, BUFSIZE, of) && !strcmp(buffer, "\xa0\xa0\x20\xa0"));
   fclose(of);
+  fclose(file(in5));
+  // bits are unfolded from host words (starting within a byte)
+  const char *pattern = "\x0f\xf0\x55\xaa\x33\xcc\x81\x7e\xc3\x3c";
+  int in6 = from_bit_file(tmpfile());
+  protect(&in6);
+  fwrite(pattern, 1, 10, file(in6));
+  rewind(file(in6));
+  int unfolded = eval(drop(in6, from_int(3)));
+  protect(&unfolded);
+  int k;
+  for (k = 3; k < 80; k++) {
+    assert(is_f(first(unfolded)) == (pattern[k / 8] >> (7 - k % 8) & 1));
+    unfolded = eval(rest(unfolded));
+  };
+  assert(is_f(unfolded));
+  unprotect(1);
+  fclose(file(in6));
+  assert(to_int(pair(t(), pair(f(), from_int(3)))) == 13);
   int i, j;
   // Integer addition
   for (i=0; i<5; i++)
@@ -1026,37 +6363,46 @@ int main(void)
   for (i=0; i<5; i++)
     for (j=0; j<5; j++)
       assert(to_int(mul(from_int(i), from_int(j))) == i * j);
+  // Arithmetic on lists of bits
+  for (i=0; i<5; i++)
+    for (j=0; j<5; j++) {
+      assert(to_int(add_list(from_int(i), from_int(j))) == i + j);
+      if (i >= j)
+        assert(to_int(sub_list(from_int(i), from_int(j))) == i - j);
+      assert(to_int(mul_list(from_int(i), from_int(j))) == i * j);
+    };
+  // Native numbers mixed with lists of bits
+  for (i=0; i<5; i++)
+    for (j=0; j<5; j++) {
+      assert(to_int(add(from_int(i), add_list(from_int(j), f()))) == i + j);
+      if (i >= j)
+        assert(to_int(sub(add_list(from_int(i), f()), from_int(j))) == i - j);
+      assert(to_int(mul(from_int(i), add_list(from_int(j), f()))) == i * j);
+    };
+  for (i=0; i<8; i++)
+    assert(!is_f(eq_bool(at(sub(from_int(1), from_int(3)), i),
+                         at(sub_list(from_int(1), from_int(3)), i))));
+  // Big numbers
+  int big = mul(from_int(65536), from_int(65536));
+  protect(&big);
+  assert(is_type(eval(big), BIGNUM));
+  assert(n_limbs(eval(big)) == 2);
+  assert(!is_f(at(big, 32)));
+  assert(is_f(at(big, 31)));
+  assert(is_f(at(big, 0)));
+  assert(to_int(sub(big, mul(from_int(65535), from_int(65537)))) == 1);
+  assert(to_int(sub(add(from_int(INT32_MAX), from_int(1)), from_int(2))) == INT32_MAX - 1);
+  assert(is_type(eval(mul(big, big)), BIGNUM));
+  assert(!is_f(eq_num(mul(big, big), mul(mul(big, from_int(65536)), from_int(65536)))));
+  assert(!is_f(eq_num(add(big, big), add_list(big, big))));
+  assert(!is_f(eq_num(sub(big, from_int(12345)), sub_list(big, from_int(12345)))));
+  assert(is_f(eq_num(mul(big, big), mul(big, add(big, from_int(1))))));
+  unprotect(1);
 #if 1
-  // REPL
+  // REPL (the term is shared with the benchmarks)
   // state: parsed name, parsed string, lut of variables
-  int repl = call(recursive(lambda2(op_if(empty(var(0)),
-    op_if(empty(at(var(1), 0)),
-          f(),
-          from_str("Unexpected EOF\n")),
-    call(lookup_num(list4(pair(from_int('\n'),
-                               concat(concat(at(var(1), 0),
-                                             list1(from_int('\n'))),
-                                      call2(var(2),
-                                            rest(var(0)),
-                                            replace(var(1), 0, f())))),
-                          pair(from_int(' '),
-                               call2(var(2),
-                                     rest(var(0)),
-                                     var(1))),
-                          pair(from_int('\t'),
-                               call2(var(2),
-                                     rest(var(0)),
-                                     var(1))),
-                          pair(from_int('='),
-                               from_str("Unexpected '='\n"))),
-                    lambda(call2(var(3),
-                                 rest(var(1)),
-                                 replace(var(2),
-                                         0,
-                                         concat(at(var(2), 0),
-                                                list1(first(var(1)))))))),
-         first(var(0)))))),
-    list1(f()));
+  int repl = repl_term();
+  protect(&repl);
   assert(!strcmp(to_str(call(repl, from_str(""))), ""));
   assert(!strcmp(to_str(call(repl, from_str("12"))), "Unexpected EOF\n"));
   assert(!strcmp(to_str(call(repl, from_str("123\n"))), "123\n"));
@@ -1066,6 +6412,7 @@ int main(void)
 #endif
 #if 0
   int interpreter = call(repl, from_file(stdin));
+  protect(&interpreter);
   while (1) {
     interpreter = eval(interpreter);
     if (!is_f(empty(interpreter)))
@@ -1074,7 +6421,384 @@ int main(void)
     interpreter = rest(interpreter);
   };
 #endif
+  // loading programs
+  assert_equal(load("0010", 4, BLC_BITS), lambda(var(0)));
+  assert_equal(load(" 00 00 110\n", 11, BLC_BITS), lambda2(var(1)));
+  assert_equal(load("01 0010 0010", 12, BLC_BITS), call(lambda(var(0)), lambda(var(0))));
+  assert_equal(load("\x20", 1, BLC_BYTES), lambda(var(0)));
+  assert_equal(load("\x07\x40", 2, BLC_BYTES), lambda2(call(var(1), var(0))));
+  assert(load("001", 3, BLC_BITS) < 0 && !strcmp(load_error, "Unexpected end of program"));
+  assert(load("0012", 4, BLC_BITS) < 0 && !strcmp(load_error, "Unexpected character"));
+  assert(load("00110", 5, BLC_BITS) < 0 && !strcmp(load_error, "Unbound variable"));
+  assert(load("0010 1", 6, BLC_BITS) < 0 && load_position == 5);
+  assert_equal(load("\\0", 2, DE_BRUIJN), lambda(var(0)));
+  assert_equal(load("\\ \\ 1 0 1", 9, DE_BRUIJN), lambda2(call(call(var(1), var(0)), var(1))));
+  assert_equal(load("\\ 0 \\ 0", 7, DE_BRUIJN), lambda(call(var(0), lambda(var(0)))));
+  assert_equal(load("(\\0) (\\ \xce\xbb 1)", 13, DE_BRUIJN), call(lambda(var(0)), lambda2(var(1))));
+  assert_equal(load("# identity\n\\0", 13, DE_BRUIJN), lambda(var(0)));
+  assert(load("\\ 1", 3, DE_BRUIJN) < 0 && !strcmp(load_error, "Unbound variable"));
+  assert(load("(\\ 0", 4, DE_BRUIJN) < 0 && !strcmp(load_error, "Missing ')'"));
+  assert(load("\\ 0)", 4, DE_BRUIJN) < 0 && !strcmp(load_error, "Unexpected ')'"));
+  assert(load("\\ ()", 4, DE_BRUIJN) < 0 && !strcmp(load_error, "Expression expected"));
+  assert(load("", 0, DE_BRUIJN) < 0 && !strcmp(load_error, "Expression expected"));
+  // strictness analysis
+  int strict = call(lambda(op_if(var(0), f(), t())), call(id(), t()));
+  analyse(strict);
+  assert(strict_mask(strict) == 1);
+  assert(is_f(strict));
+  int lazy = call(lambda(op_if(t(), f(), var(0))),
+                  call(lambda(call(var(0), var(0))), lambda(call(var(0), var(0)))));
+  analyse(lazy);
+  assert(strict_mask(lazy) == 0);
+  assert(is_f(lazy));
+  strict = call2(lambda2(op_if(var(1), var(0), f())), call(id(), f()), call(id(), t()));
+  analyse(strict);
+  assert(strict_mask(strict) == 2);
+  assert(is_f(strict));
+  const char *source = "(\\ 0 0) ((\\ 0) \\ 0)";
+  strict = load(source, strlen(source), DE_BRUIJN);
+  assert(strict_mask(strict) == 1);
+  strict = eval(strict);
+  assert_equal(strict, proc(var(0), f()));
+  strict = call(lambda(add(var(0), from_int(1))), mul_list(from_int(1234), from_int(5678)));
+  analyse(strict);
+  assert(strict_mask(strict) == 1);
+  protect(&strict);
+  while (is_suspended(strict))
+    strict = eval_budget(strict, 10, 0);
+  assert(to_int(strict) == 1234 * 5678 + 1);
+  unprotect(1);
+  // (the call of a known function further down a long spine is annotated)
+  int known = call(lambda(op_if(var(0), t(), f())), call(id(), f()));
+  strict = known;
+  for (i = 0; i < 2 * MAX_SPINE; i++)
+    strict = call(strict, var(0));
+  analyse(strict);
+  assert(strict_mask(known) == 1 && strict_mask(strict) == 0);
+  // (deeply nested programs are analysed without recursion)
+  int nesting = 200000;
+  char *nested = malloc(4 * nesting + 3);
+  if (!nested)
+    abort();
+  strcpy(nested, "\\ ");
+  for (i = 0; i < nesting; i++)
+    strcpy(nested + 2 + 3 * i, "0 (");
+  nested[2 + 3 * nesting] = '0';
+  memset(nested + 3 + 3 * nesting, ')', nesting);
+  strict = load(nested, 3 + 4 * nesting, DE_BRUIJN);
+  assert(strict >= 0 && strict_mask(body(strict)) == 0);
+  free(nested);
+  // simplification of terms
+  assert_equal(simplify(op_if(t(), var(1), var(2))), var(1));
+  assert_equal(simplify(op_if(f(), var(1), var(2))), var(2));
+  assert_equal(simplify(first(pair(var(1), var(2)))), var(1));
+  assert_equal(simplify(rest(pair(var(1), var(2)))), var(2));
+  assert_equal(simplify(pair(var(1), var(2))), pair(var(1), var(2)));
+  assert_equal(simplify(call(lambda(call(var(0), var(0))), var(3))), call(var(3), var(3)));
+  assert_equal(simplify(call(lambda(call(var(0), var(1))), call(var(1), var(2)))),
+               call(call(var(1), var(2)), var(0)));
+  assert_equal(simplify(call(lambda(call(var(0), var(0))), call(var(1), var(2)))),
+               call(lambda(call(var(0), var(0))), call(var(1), var(2))));
+  assert_equal(simplify(call(lambda(lambda(var(1))), call(var(0), var(0)))),
+               call(lambda(lambda(var(1))), call(var(0), var(0))));
+  assert_equal(simplify(call2(lambda2(call(var(1), var(0))), call(var(2), var(2)), var(3))),
+               call(var(3), call(var(2), var(2))));
+  assert_equal(simplify(lambda(call(f(), var(0)))), f());
+  assert_equal(simplify(lambda(call(var(1), var(0)))), lambda(call(var(1), var(0))));
+  assert_equal(simplify(call(even_, var(0))), op_if(empty(var(0)), t(), op_not(first(var(0)))));
+  assert(simplify(recursive_) == recursive_);
+  // graph reduction of combinators
+  assert_equal(combinators(lambda(var(0))), comb(COMB_I));
+  assert_equal(combinators(lambda2(var(1))), comb(COMB_K));
+  assert_equal(combinators(lambda2(var(0))), app(comb(COMB_K), comb(COMB_I)));
+  assert_equal(combinators(lambda2(call(var(1), var(0)))), comb(COMB_I));
+  assert_equal(combinators(lambda2(call(var(0), var(1)))), app(comb(COMB_C), comb(COMB_I)));
+  assert_equal(combinators(lambda3(call(var(2), call(var(1), var(0))))), comb(COMB_B));
+  assert_equal(combinators(lambda3(call(call(var(2), var(0)), var(1)))), comb(COMB_C));
+  assert_equal(combinators(lambda3(call(call(var(2), var(0)), call(var(1), var(0))))), comb(COMB_S));
+  assert_equal(combinators(lambda(call(var(0), var(0)))),
+               app(app(comb(COMB_S), comb(COMB_I)), comb(COMB_I)));
+  assert_equal(combinators(pair_), app(comb(COMB_C), comb(COMB_V)));
+  // the graph of a closed lambda is shared within one translation only
+  int constant = lambda(add(from_int(1), from_int(2)));
+  protect(&constant);
+  int twice = combinators(call(constant, constant));
+  assert(app_fun(twice) == app_arg(twice));
+  assert(combinators(constant) != combinators(constant));
+  (void)twice;
+  unprotect(1);
+  graph_reduction = 1;
+  assert(to_int(call(lambda(add(var(0), var(0))), from_int(21))) == 42);
+  assert(to_int(mul_list(from_int(7), from_int(6))) == 42);
+  assert(!strcmp(to_str(map(from_str("abc"), lambda(var(0)))), "abc"));
+  assert(!strcmp(to_str(concat(from_str("ab"), from_str("cd"))), "abcd"));
+  assert(is_f(eq_str(from_str("abc"), from_str("abd"))));
+  assert(to_int(call(recursive(lambda(op_if(empty(var(0)), from_int(0),
+                                            call(var(1), sub(var(0), from_int(1)))))),
+                     from_int(1000))) == 0);
+  // applications which select from a pair are replaced with the element
+  int graph_rest = app(app(comb(COMB_C), comb(COMB_I)), app(comb(COMB_K), comb(COMB_I)));
+  protect(&graph_rest);
+  int graph_pair = app(app(comb(COMB_V), from_int(1)), from_int(2));
+  protect(&graph_pair);
+  int graph_selector = app(graph_rest, app(comb(COMB_I), graph_pair));
+  protect(&graph_selector);
+  int graph_first = app(app(app(comb(COMB_C), comb(COMB_I)), comb(COMB_K)), graph_pair);
+  protect(&graph_first);
+  int graph_chained = app(graph_rest, app(app(comb(COMB_V), from_int(0)), app(graph_rest, graph_pair)));
+  protect(&graph_chained);
+  gc();
+  assert(is_type(graph_selector, INTEGER) && intval(graph_selector) == 2);
+  assert(is_type(graph_first, INTEGER) && intval(graph_first) == 1);
+  assert(is_type(graph_chained, INTEGER) && intval(graph_chained) == 2);
+  unprotect(5);
+  // graph reduction stops at the budgets
+  int budgeted = eval_budget(mul_list(from_int(1234), from_int(5678)), 100, 0);
+  protect(&budgeted);
+  assert(is_suspended(budgeted));
+  while (is_suspended(budgeted)) {
+    long steps = n_steps;
+    budgeted = eval_budget(budgeted, 100, 0);
+    assert(n_steps - steps <= 100);
+    (void)steps;
+  };
+  assert(to_int(budgeted) == 1234 * 5678);
+  budgeted = call(lambda(call(var(0), var(0))), lambda(call(var(0), var(0))));
+  long reduced = cells_allocated();
+  budgeted = eval_budget(budgeted, 0, 10000);
+  assert(is_suspended(budgeted));
+  assert(cells_allocated() - reduced < 10000 + GC_MARGIN);
+  (void)reduced;
+  unprotect(1);
+  graph_reduction = 0;
+  assert(load("\\ x", 3, DE_BRUIJN) < 0 && load_position == 2);
+  assert(!strcmp(to_str(call(load("\\0", 2, DE_BRUIJN), from_str("abc"))), "abc"));
+  assert(load_file("/nonexistent.blc") < 0 && !strcmp(load_error, "Could not open file"));
+  unprotect(n_roots - test_roots);
+  // garbage collection
+  int gc1 = list2(from_int(5), from_str("ab"));
+  protect(&gc1);
+  int garbage = n_cells - heap_start;
+  gc();
+  int live = n_cells - heap_start;
+  (void)garbage;
+  (void)live;
+  assert(live < garbage);
+  assert(to_int(first(gc1)) == 5);
+  assert(!strcmp(to_str(at(gc1, 1)), "ab"));
+  gc();
+  assert(n_cells - heap_start == live);
+  assert(peak_cells() >= live);
+  assert(is_f(rest(rest(gc1))));
+  if (hash_consing)
+    assert(gc1 == list2(from_int(5), first_(rest_(gc1))));
+  unprotect(1);
+  // an updated thunk does not keep its environment alive
+  char long_text[257];
+  memset(long_text, 'x', 256);
+  long_text[256] = '\0';
+  int updated = wrap(call(id(), first(var(0))), extend(f(), eval(pair(from_int(5), from_str(long_text)))));
+  protect(&updated);
+  gc();
+  live = n_cells - heap_start;
+  assert(to_int(updated) == 5);
+  assert(unwrap(updated) == cache(updated) && context(updated) == cache(updated));
+  gc();
+  assert(n_cells - heap_start < live - 256 / 8);
+  unprotect(1);
+  // thunks which select from an evaluated pair are replaced with the element
+  int selected = eval(pair(from_int(1), from_int(2)));
+  int selector = wrap(rest(var(0)), extend(f(), selected));
+  protect(&selector);
+  int unselected = wrap(rest(var(0)), extend(f(), wrap(pair(from_int(1), from_int(2)), f())));
+  protect(&unselected);
+  int first_selector = wrap(first(var(0)), extend(f(), selected));
+  protect(&first_selector);
+  int chained = wrap(rest(var(0)), extend(f(), pair_value(from_int(0), wrap(rest(var(0)), extend(f(), selected)))));
+  protect(&chained);
+  gc();
+  assert(is_type(selector, INTEGER) && to_int(selector) == 2);
+  assert(is_type(unselected, WRAP) && to_int(unselected) == 2);
+  assert(is_type(first_selector, INTEGER) && to_int(first_selector) == 1);
+  assert(is_type(chained, INTEGER) && to_int(chained) == 2);
+  unprotect(4);
+  // the cells of heap images are validated before they are mapped
+  cell_t image_cells[3] = {{(uint32_t)LAMBDA << FIELD_BITS | 1, 0},
+                           {(uint32_t)PAIR << FIELD_BITS | 2, (uint32_t)-1},
+                           {(uint32_t)VAR << FIELD_BITS, 0}};
+  (void)image_cells;
+  assert(valid_cells(image_cells, 3));
+  image_cells[1].tail = 3;
+  assert(!valid_cells(image_cells, 3));
+  image_cells[1].tail = 0;
+  image_cells[2].head = (uint32_t)(APP + 1) << FIELD_BITS;
+  assert(!valid_cells(image_cells, 3));
+  image_cells[2].head = (uint32_t)WRAP << FIELD_BITS;
+  assert(!valid_cells(image_cells, 3));
+  // garbage collection during evaluation
+  for (i=0; i<3000; i+=101) {
+    gc_threshold = n_cells + i;
+    assert(to_int(mul_list(from_int(7), from_int(6))) == 42);
+    gc_threshold = n_cells + i;
+    assert(!strcmp(to_str(concat(from_str("ab"), from_str("cd"))), "abcd"));
+    gc_threshold = n_cells + i;
+    assert(!strcmp(to_str(concat(list1(from_int('a')), from_str("b"))), "ab"));
+    gc_threshold = n_cells + i;
+    assert(!strcmp(to_str(find(from_str("abcabd"), list2(from_int('b'), from_int('d')))), "bd"));
+    gc_threshold = n_cells + i;
+    assert(to_int(call(lookup_str(list2(pair(from_str("Jan"), from_int(31)),
+                                        pair(from_str("Feb"), from_int(28))),
+                                  lambda(from_int(30))),
+                       from_str("Feb"))) == 28);
+  };
+  // evaluation with budgets
+  int slices = 0;
+  int suspended = eval_budget(mul_list(from_int(1234), from_int(5678)), 10, 0);
+  protect(&suspended);
+  while (is_suspended(suspended)) {
+    suspended = eval_budget(suspended, 10, 0);
+    slices++;
+  };
+  assert(slices > 0);
+  assert(to_int(suspended) == 1234 * 5678);
+  int omega = call(lambda(call(var(0), var(0))), lambda(call(var(0), var(0))));
+  long allocated = cells_allocated();
+  (void)allocated;
+  suspended = eval_budget(omega, 0, 10000);
+  assert(is_suspended(suspended));
+  assert(cells_allocated() - allocated < 10000 + GC_MARGIN);
+  suspended = eval_budget(suspended, 1000, 0);
+  assert(is_suspended(suspended));
+  int slice1 = call(lookup_str(list2(pair(from_str("Jan"), from_int(31)),
+                                     pair(from_str("Feb"), from_int(28))),
+                               lambda(from_int(30))),
+                    map(from_str("Feb"), lambda(var(0))));
+  protect(&slice1);
+  int slice2 = call2(concat_list_, from_str("ab"), from_str("cd"));
+  protect(&slice2);
+  slices = 0;
+  while (is_suspended(slice1) || is_suspended(slice2)) {
+    if (is_suspended(slice1))
+      slice1 = eval_budget(slice1, 10, 0);
+    if (is_suspended(slice2))
+      slice2 = eval_budget(slice2, 10, 0);
+    slices++;
+  };
+  assert(slices > 1);
+  assert(to_int(slice1) == 28);
+  assert(!strcmp(to_str(slice2), "abcd"));
+  unprotect(3);
+  // parallel evaluation with sparks
+  assert(to_int(seq(from_int(1), from_int(2))) == 2);
+  int thunk = wrap(mul(from_int(6), from_int(7)), f());
+  protect(&thunk);
+  assert(to_int(call(lambda(seq(var(0), from_int(1))), thunk)) == 1);
+  assert(cache(thunk) != thunk && to_int(cache(thunk)) == 42);
+  unprotect(1);
+  // (the graph reducer does not spark)
+  int saved_graph_reduction = graph_reduction;
+  graph_reduction = 0;
+  int saved_workers = workers;
+  workers = 0;
+  assert(to_int(call(lambda(par(var(0), var(0))), from_int(5))) == 5);
+  assert(n_sparks == 0 && !sharing);
+  workers = 2;
+  // The spine is evaluated first so that the workers evaluate the elements.
+  long sparked = n_sparked;
+  int squares = eval(par_map(list3(from_int(1234), from_int(10000), from_int(7)),
+                             lambda(mul_list(var(0), var(0)))));
+  protect(&squares);
+  eval(rest(rest(squares)));
+  wait_for_workers();
+  assert(sharing && n_sparked == sparked + 3);
+  (void)sparked;
+  assert(to_int(first(squares)) == 1234 * 1234);
+  assert(to_int(first(rest(squares))) == 10000 * 10000);
+  assert(to_int(first(rest(rest(squares)))) == 49);
+  // elements may be demanded while the workers evaluate them
+  squares = eval(par_map(list2(from_str("ab"), from_str("c")), lambda(concat(var(0), var(0)))));
+  assert(!strcmp(to_str(first(squares)), "abab"));
+  assert(!strcmp(to_str(first(rest(squares))), "cc"));
+  squares = eval(par_map(list2(from_int(3), from_int(4)), lambda(lambda(var(1)))));
+  assert(to_int(call(first(rest(squares)), f())) == 4);
+  // the rest of the list is not evaluated
+  squares = par_map(recursive(pair(from_int(3), var(0))), lambda(mul_list(var(0), var(0))));
+  assert(to_int(at(squares, 2)) == 9);
+  unprotect(1);
+  // only the thread which claimed a thunk updates it
+  thunk = wrap(mul(from_int(6), from_int(7)), f());
+  protect(&thunk);
+  set_field(thunk + 1, thread_mark + 1);
+  store(thunk, from_int(0));
+  assert(cache(thunk) == thunk);
+  set_field(thunk + 1, 0);
+  assert(to_int(thunk) == 42);
+  unprotect(1);
+  // sparks of thunks which were collected are dropped and workers evaluating
+  // them are cancelled
+  wait_for_workers();
+  gc();
+  assert(n_sparks == 0);
+  omega = call(lambda(call(var(0), var(0))), lambda(call(var(0), var(0))));
+  assert(to_int(call(lambda(par(var(0), from_int(1))), omega)) == 1);
+  gc();
+  wait_for_workers();
+  assert(n_sparks == 0);
+  // stopping the workers abandons their sparks (see close_vm)
+  omega = call(lambda(call(var(0), var(0))), lambda(call(var(0), var(0))));
+  assert(to_int(call(lambda(par(var(0), from_int(1))), omega)) == 1);
+  stop_pool();
+  assert(!sharing && n_sparks == 0);
+  int restarted = to_int(call(lambda(par(var(0), var(0))), add(from_int(2), from_int(3))));
+  assert(restarted == 5 && sharing);
+  (void)restarted;
+  workers = saved_workers;
+  graph_reduction = saved_graph_reduction;
+  // profiler
+  assert(global(N_GLOBALS - 1) == &par_map_);
+  int saved_profile = profile;
+  profile = 1;
+  profile_steps[CALL] = 0;
+  profile_allocs[WRAP] = 0;
+  profile_hits = profile_misses = 0;
+  gc_threshold = n_cells;
+  assert(!strcmp(to_str(map(from_str("abc"), lambda(var(0)))), "abc"));
+  assert(profile_steps[CALL] > 0);
+  assert(profile_allocs[WRAP] > 0);
+  assert(profile_hits + profile_misses > 0);
+  assert(n_profile_entries > 0);
+  FILE *pf = tmpfile();
+  profile_report(pf);
+  rewind(pf);
+  int found = 0;
+  while (fgets(buffer, BUFSIZE, pf))
+    found |= !strncmp(buffer, "entries\tmap\t", 12);
+  assert(found);
+  fclose(pf);
+  // a request for a profile is served at the next safe point
+  const char *saved_profile_name = profile_name;
+  profile_name = "/dev/null";
+  profile_requested = 1;
+  eval(map(from_str("abc"), lambda(var(0))));
+  assert(!profile_requested);
+  profile_name = saved_profile_name;
+  profile = saved_profile;
+  // several interpreters in one process
+  if (share_prelude())
+    abort();
+  pthread_t threads[4];
+  int numbers[4];
+  for (i = 0; i < 4; i++) {
+    numbers[i] = 1000 + i;
+    if (pthread_create(&threads[i], NULL, run_vm, &numbers[i]))
+      abort();
+  };
+  for (i = 0; i < 4; i++) {
+    pthread_join(threads[i], NULL);
+    assert(numbers[i] == (1000 + i) * (1000 + i) + 1);
+  };
   // show statistics
-  fprintf(stderr, "Test suite requires %d cells.\n", cell(VAR) - n - 1);
+  fprintf(stderr, "Test suite requires %d cells (%d collections, heap of %d cells, %ld steps).\n",
+          peak_cells(), n_collections, heap_size, n_steps);
   return 0;
 }